@@ -0,0 +1,531 @@
+/*
+ * bench.c:
+ *	Transport micro benchmark: runs every accessor of comm.c, opto.c,
+ *	led.c and wdt.c, getters and setters, against the selected backend
+ *	and reports ops/s, bus transfers and ioctl system calls per op and
+ *	latency percentiles. The setters write back the values read at start.
+ *
+ *	Usage: bench [--transport=<i2c-dev|loop|sim>] [--bus=<n>]
+ *	             [--stack=<id>] [--ops=<n>] [<name filter>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "comm.h"
+#include "data.h"
+#include "hist.h"
+#include "led.h"
+#include "opto.h"
+#include "shadow.h"
+#include "wdt.h"
+
+#define BENCH_OPS_DEFAULT	10000
+
+typedef int (*BenchFuncType)(int dev);
+
+typedef struct
+{
+	const char* name;
+	BenchFuncType func;
+} BenchOpType;
+
+typedef struct
+{
+	const char* cmd;
+	int (*func)(int argc, char *argv[]);
+} BenchCliType;
+
+static char gStackArg[8] = "0";
+
+// values of the board at start, written back by the setters
+static char gLedArg[12];
+static char gWdtPeriodArg[12];
+static char gWdtInitArg[12];
+static char gWdtOffArg[12];
+static uint8_t gEncState;
+static uint8_t gIntState;
+static int gPowerLedMode;
+
+/*
+ * ioctl system calls of the process: the benchmark is linked with
+ * --wrap=ioctl. The in-process backends (loop, sim) issue none.
+ */
+static uint64_t gIoctls = 0;
+
+int __real_ioctl(int fd, unsigned long req, ...);
+
+int __wrap_ioctl(int fd, unsigned long req, ...)
+{
+	va_list ap;
+	void* arg;
+
+	va_start(ap, req);
+	arg = va_arg(ap, void*);
+	va_end(ap);
+	gIoctls++;
+	return __real_ioctl(fd, req, arg);
+}
+
+static const BenchCliType gBenchCli[] =
+{
+	{ "ledrd", doLedRead },
+	{ "ledwr", doLedWrite },
+	{ "optcntrd", doOptoCntRead },
+	{ "wdtr", doWdtReload },
+	{ "wdtprd", doWdtGetPeriod },
+	{ "wdtpwr", doWdtSetPeriod },
+	{ "wdtipwr", doWdtSetInitPeriod },
+	{ "wdtopwr", doWdtSetOffPeriod },
+	{ "wdtrcrd", doWdtGetResetCount },
+	{ "wdtrcclr", doWdtClearResetCount },
+
+	{ NULL, NULL }
+};
+
+// CLI handlers print their result, the output goes to /dev/null
+static int benchCli(const char* cmd, const char* arg)
+{
+	char* argv[5] = { PROGRAM_NAME, gStackArg, (char*)cmd, (char*)arg, NULL };
+	int i;
+
+	for (i = 0; gBenchCli[i].cmd != NULL; i++)
+	{
+		if (0 == strcmp(cmd, gBenchCli[i].cmd))
+		{
+			return gBenchCli[i].func(NULL == arg ? 3 : 4, argv);
+		}
+	}
+	return ERROR;
+}
+
+// Read the values the setters write back, so a run leaves the card as it was
+static void benchSave(int dev)
+{
+	uint8_t buf[4] = { 0, 0, 0, 0 };
+	uint32_t val;
+
+	i2cMem8Read(dev, I2C_MEM_LEDS, buf, 2);
+	snprintf(gLedArg, sizeof(gLedArg), "%u", buf[0] | (buf[1] << 8));
+	memset(buf, 0, sizeof(buf));
+	i2cMem8Read(dev, I2C_MEM_WDT_INTERVAL_GET_ADD, buf, 2);
+	snprintf(gWdtPeriodArg, sizeof(gWdtPeriodArg), "%u", buf[0] | (buf[1] << 8));
+	memset(buf, 0, sizeof(buf));
+	i2cMem8Read(dev, I2C_MEM_WDT_INIT_INTERVAL_GET_ADD, buf, 2);
+	snprintf(gWdtInitArg, sizeof(gWdtInitArg), "%u", buf[0] | (buf[1] << 8));
+	i2cMem8Read(dev, I2C_MEM_WDT_POWER_OFF_INTERVAL_GET_ADD, buf, 4);
+	memcpy(&val, buf, 4);
+	snprintf(gWdtOffArg, sizeof(gWdtOffArg), "%u", (unsigned)val);
+	optoEncStateRead(dev, 1, &gEncState);
+	optoIntRead(dev, 1, &gIntState);
+	powerLedGetMode(dev, &gPowerLedMode);
+}
+
+static int benchMem8ReadInputs(int dev)
+{
+	uint8_t buf[2];
+
+	return i2cMem8Read(dev, I2C_MEM_OPTO, buf, 2);
+}
+
+static int benchMem8ReadCounters(int dev)
+{
+	uint8_t buf[COUNTER_SIZE * OPTO_CH_NO];
+
+	return i2cMem8Read(dev, I2C_MEM_OPTO_EDGE_COUNT_ADD, buf, sizeof(buf));
+}
+
+static int benchMem8ReadMulti(int dev)
+{
+	uint8_t in[2];
+	uint8_t cnt[COUNTER_SIZE * OPTO_CH_NO];
+	uint8_t freq[IN_FREQENCY_SIZE * OPTO_CH_NO];
+	uint8_t pwm[PWM_IN_FILL_SIZE * OPTO_CH_NO];
+	I2cReadSegType seg[4] =
+	{
+		{ I2C_MEM_OPTO, in, sizeof(in), 0, 0, 0, 0 },
+		{ I2C_MEM_OPTO_EDGE_COUNT_ADD, cnt, sizeof(cnt), 0, 0, 0, 0 },
+		{ I2C_MEM_IN_FREQENCY, freq, sizeof(freq), 0, 0, 0, 0 },
+		{ I2C_MEM_PWM_IN_FILL, pwm, sizeof(pwm), 0, 0, 0, 0 },
+	};
+
+	return i2cMem8ReadMulti(dev, seg, 4);
+}
+
+static int benchMem8Write(int dev)
+{
+	uint8_t buf[2] = { 0, 0 };
+
+	return i2cMem8Write(dev, I2C_MEM_LEDS, buf, 2);
+}
+
+static int benchShadowRefresh(int dev)
+{
+	int ret = ERROR;
+
+	if (OK == shadowEnable(dev))
+	{
+		ret = shadowRefresh(dev, 0, SLAVE_BUFF_SIZE);
+	}
+	shadowDisable(dev);
+	return ret;
+}
+
+static int benchOptoGet(int dev)
+{
+	int val;
+
+	return optoGet(dev, &val);
+}
+
+static int benchOptoEdgeGet(int dev)
+{
+	uint8_t val;
+
+	return optoEdgeGet(dev, 1, &val);
+}
+
+static int benchOptoCountGet(int dev)
+{
+	uint32_t val;
+
+	return optoCountGet(dev, 1, &val);
+}
+
+// The per channel way of reading the whole counter bank
+static int benchOptoCountGet16(int dev)
+{
+	uint32_t val;
+	int ch;
+
+	for (ch = 1; ch <= OPTO_CH_NO; ch++)
+	{
+		if (OK != optoCountGet(dev, ch, &val))
+		{
+			return ERROR;
+		}
+	}
+	return OK;
+}
+
+static int benchOptoFreqGet(int dev)
+{
+	uint16_t val;
+
+	return optoFreqGet(dev, 1, &val);
+}
+
+static int benchOptoPWMFillGet(int dev)
+{
+	float val;
+
+	return optoPWMFillGet(dev, 1, &val);
+}
+
+static int benchOptoEncGetCnt(int dev)
+{
+	int val;
+
+	return optoEncGetCnt(dev, 1, &val);
+}
+
+static int benchOptoEncStateRead(int dev)
+{
+	uint8_t val;
+
+	return optoEncStateRead(dev, 1, &val);
+}
+
+static int benchOptoIntRead(int dev)
+{
+	uint8_t val;
+
+	return optoIntRead(dev, 1, &val);
+}
+
+static int benchOptoEdgeSet(int dev)
+{
+	return optoEdgeSet(dev, 1, 1);
+}
+
+static int benchOptoCountReset(int dev)
+{
+	return optoCountReset(dev, 1);
+}
+
+static int benchOptoEncStateWrite(int dev)
+{
+	return optoEncStateWrite(dev, 1, gEncState);
+}
+
+static int benchOptoEncRstCnt(int dev)
+{
+	return optoEncRstCnt(dev, 1);
+}
+
+static int benchOptoIntSet(int dev)
+{
+	return optoIntSet(dev, 1, gIntState);
+}
+
+static int benchLedGetMode(int dev)
+{
+	int val;
+
+	return ledGetMode(dev, 1, &val);
+}
+
+static int benchLedSetMode(int dev)
+{
+	return ledSetMode(dev, 1, 0);
+}
+
+static int benchPowerLedGetMode(int dev)
+{
+	int val;
+
+	return powerLedGetMode(dev, &val);
+}
+
+static int benchPowerLedSetMode(int dev)
+{
+	return powerLedSetMode(dev, gPowerLedMode);
+}
+
+static int benchCliLedRead(int dev)
+{
+	(void)dev;
+	return benchCli("ledrd", NULL);
+}
+
+static int benchCliLedWrite(int dev)
+{
+	(void)dev;
+	return benchCli("ledwr", gLedArg);
+}
+
+static int benchCliOptoCntRead(int dev)
+{
+	(void)dev;
+	return benchCli("optcntrd", "1");
+}
+
+static int benchCliWdtReload(int dev)
+{
+	(void)dev;
+	return benchCli("wdtr", NULL);
+}
+
+static int benchCliWdtGetPeriod(int dev)
+{
+	(void)dev;
+	return benchCli("wdtprd", NULL);
+}
+
+static int benchCliWdtGetResetCount(int dev)
+{
+	(void)dev;
+	return benchCli("wdtrcrd", NULL);
+}
+
+static int benchCliWdtSetPeriod(int dev)
+{
+	(void)dev;
+	return benchCli("wdtpwr", gWdtPeriodArg);
+}
+
+static int benchCliWdtSetInitPeriod(int dev)
+{
+	(void)dev;
+	return benchCli("wdtipwr", gWdtInitArg);
+}
+
+static int benchCliWdtSetOffPeriod(int dev)
+{
+	(void)dev;
+	return benchCli("wdtopwr", gWdtOffArg);
+}
+
+static int benchCliWdtClearResetCount(int dev)
+{
+	(void)dev;
+	return benchCli("wdtrcclr", NULL);
+}
+
+static const BenchOpType gBenchOps[] =
+{
+	{ "i2cMem8Read inputs", benchMem8ReadInputs },
+	{ "i2cMem8Read counters", benchMem8ReadCounters },
+	{ "i2cMem8ReadMulti x4", benchMem8ReadMulti },
+	{ "i2cMem8Write leds", benchMem8Write },
+	{ "shadowRefresh map", benchShadowRefresh },
+	{ "optoGet", benchOptoGet },
+	{ "optoEdgeGet", benchOptoEdgeGet },
+	{ "optoEdgeSet", benchOptoEdgeSet },
+	{ "optoCountGet", benchOptoCountGet },
+	{ "optoCountGet x16", benchOptoCountGet16 },
+	{ "optoCountReset", benchOptoCountReset },
+	{ "optoFreqGet", benchOptoFreqGet },
+	{ "optoPWMFillGet", benchOptoPWMFillGet },
+	{ "optoEncGetCnt", benchOptoEncGetCnt },
+	{ "optoEncRstCnt", benchOptoEncRstCnt },
+	{ "optoEncStateRead", benchOptoEncStateRead },
+	{ "optoEncStateWrite", benchOptoEncStateWrite },
+	{ "optoIntRead", benchOptoIntRead },
+	{ "optoIntSet", benchOptoIntSet },
+	{ "ledGetMode", benchLedGetMode },
+	{ "ledSetMode", benchLedSetMode },
+	{ "powerLedGetMode", benchPowerLedGetMode },
+	{ "powerLedSetMode", benchPowerLedSetMode },
+	{ "doLedRead", benchCliLedRead },
+	{ "doLedWrite", benchCliLedWrite },
+	{ "doOptoCntRead", benchCliOptoCntRead },
+	{ "doWdtReload", benchCliWdtReload },
+	{ "doWdtGetPeriod", benchCliWdtGetPeriod },
+	{ "doWdtSetPeriod", benchCliWdtSetPeriod },
+	{ "doWdtSetInitPeriod", benchCliWdtSetInitPeriod },
+	{ "doWdtSetOffPeriod", benchCliWdtSetOffPeriod },
+	{ "doWdtGetResetCount", benchCliWdtGetResetCount },
+	{ "doWdtClearResetCount", benchCliWdtClearResetCount },
+
+	{ NULL, NULL }
+};
+
+static uint64_t benchNowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t benchTransfers(int dev)
+{
+	I2cStatsType st;
+
+	if (i2cStatsGet(dev, &st) != 0)
+	{
+		return 0;
+	}
+	return st.transfers;
+}
+
+static void benchRun(const BenchOpType* op, int dev, int ops, int nullOut,
+	int stdOut)
+{
+	static HistType h;
+	uint64_t start;
+	uint64_t t0;
+	uint64_t total;
+	uint64_t ioctls;
+	uint32_t xfer;
+	int fail = 0;
+	int i;
+
+	histReset(&h);
+	xfer = benchTransfers(dev);
+	ioctls = gIoctls;
+	fflush(stdout);
+	dup2(nullOut, STDOUT_FILENO);
+	start = benchNowNs();
+	for (i = 0; i < ops; i++)
+	{
+		t0 = benchNowNs();
+		if (OK != op->func(dev))
+		{
+			fail++;
+		}
+		histRecord(&h, benchNowNs() - t0);
+	}
+	total = benchNowNs() - start;
+	fflush(stdout);
+	dup2(stdOut, STDOUT_FILENO);
+	xfer = benchTransfers(dev) - xfer;
+	ioctls = gIoctls - ioctls;
+	printf("%-22s %10.0f %8.2f %9.2f %9llu %9llu %9llu %6d\n", op->name,
+		total > 0 ? ops * 1e9 / total : 0.0, (double)xfer / ops,
+		(double)ioctls / ops,
+		(unsigned long long)histPercentile(&h, 50),
+		(unsigned long long)histPercentile(&h, 99),
+		(unsigned long long)histPercentile(&h, 99.9), fail);
+}
+
+int main(int argc, char *argv[])
+{
+	const char* filter = NULL;
+	int ops = BENCH_OPS_DEFAULT;
+	int bus = -1;
+	int stack = 0;
+	int nullOut;
+	int stdOut;
+	int dev;
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--transport=", 12) == 0)
+		{
+			if (i2cTransportSet(argv[i] + 12) != 0)
+			{
+				printf("Invalid transport %s\n", argv[i] + 12);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--bus=", 6) == 0)
+		{
+			bus = atoi(argv[i] + 6);
+		}
+		else if (strncmp(argv[i], "--stack=", 8) == 0)
+		{
+			stack = atoi(argv[i] + 8);
+		}
+		else if (strncmp(argv[i], "--ops=", 6) == 0)
+		{
+			ops = atoi(argv[i] + 6);
+		}
+		else
+		{
+			filter = argv[i];
+		}
+	}
+	if (bus >= 0)
+	{
+		i2cBusSet(&bus, 1);
+	}
+	if ( (stack < 0) || (stack > 7) || (ops <= 0))
+	{
+		printf("Invalid stack level or ops count\n");
+		return 1;
+	}
+	snprintf(gStackArg, sizeof(gStackArg), "%d", stack);
+	dev = doBoardInit(stack);
+	if (dev <= 0)
+	{
+		return 1;
+	}
+	nullOut = open("/dev/null", O_WRONLY);
+	stdOut = dup(STDOUT_FILENO);
+	if ( (nullOut < 0) || (stdOut < 0))
+	{
+		return 1;
+	}
+	printf("transport %s, stack %d, %d ops per accessor, latency in ns\n",
+		i2cTransportName(), stack, ops);
+	printf("%-22s %10s %8s %9s %9s %9s %9s %6s\n", "accessor", "ops/s", "xfer/op",
+		"ioctl/op", "p50", "p99", "p999", "fail");
+	benchSave(dev);
+	for (i = 0; gBenchOps[i].name != NULL; i++)
+	{
+		if ( (NULL == filter) || (strstr(gBenchOps[i].name, filter) != NULL))
+		{
+			benchRun(&gBenchOps[i], dev, ops, nullOut, stdOut);
+		}
+	}
+	i2cClose();
+	return 0;
+}
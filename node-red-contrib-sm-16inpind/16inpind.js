@@ -1,6 +1,7 @@
 module.exports = function(RED) {
     "use strict";
     var I2C = require("i2c-bus");
+    var daemon = require("./daemon");
     const DEFAULT_HW_ADD = 0x20;
     const IN_REG = 0x00;
     const mask = new ArrayBuffer(16);
@@ -21,16 +22,38 @@ module.exports = function(RED) {
     mask[14] = 0x02;
     mask[15] = 0x01;
    
+    // msg.payload of the raw input register: one channel or the bitmap of all
+    function inputsPayload(rawData, channel) {
+        rawData = ~rawData;
+        if( channel > 0){
+          return ((rawData & mask[channel - 1]) != 0) ? 1 : 0;
+        }
+        var optoData = 0x0000;
+        var idx = 0;
+        for(idx = 0; idx < 16; idx++){
+          if( (rawData & mask[idx]) != 0){
+          optoData += 1 << idx;
+          }
+        }
+        return optoData;
+    }
+
     // The Opto input read Node
     function OptoInputNode(n) {
         RED.nodes.createNode(this, n);
         this.stack = parseInt(n.stack);
         this.channel = parseInt(n.channel);
+        this.socket = n.socket;
         this.payload = n.payload;
         this.payloadType = n.payloadType;
         var node = this;
  
-        node.port = I2C.openSync( 1 );
+        // through the 16inpindd daemon when a socket is set, the bus directly else
+        if (node.socket) {
+            node.client = new daemon.Client(node.socket);
+        } else {
+            node.port = I2C.openSync( 1 );
+        }
         node.on("input", function(msg) {
             var myPayload;
             var stack = node.stack;
@@ -58,42 +81,34 @@ module.exports = function(RED) {
             }
             //check the type of io_expander
             hwAdd += stack ^ 0x07;
-            var rawData = 0x0000;
+            if(channel < 0){
+              channel = 0;
+            }
+            if(channel > 16){
+              channel = 16;
+            }
+            if (node.client) {
+              node.client.read(stack, IN_REG, 2).then(function(data) {
+                msg.payload = inputsPayload(data.readUInt16LE(0), channel);
+                node.send(msg);
+              }).catch(function(err) {
+                node.error(err, msg);
+              });
+              return;
+            }
             try{
-              rawData = node.port.readWordSync(hwAdd, IN_REG );
-              
-              if(channel < 0){
-                channel = 0;
-              }
-              if(channel > 16){
-                channel = 16;
-              }
-              if( channel > 0){
-                channel-= 1;//zero based
-                rawData = ~rawData;
-                if( (rawData & mask[channel]) != 0){
-                  msg.payload = 1;
-                }else{
-                  msg.payload = 0;
-                }
-              }else{
-                var optoData = 0x0000;
-                var idx = 0;
-                rawData = ~rawData;
-                for(idx = 0; idx < 16; idx++){
-                  if( (rawData & mask[idx]) != 0){
-                  optoData += 1 << idx;
-                  }
-                }
-                msg.payload = optoData;
-              }
+              msg.payload = inputsPayload(node.port.readWordSync(hwAdd, IN_REG ), channel);
               node.send(msg);             
             }catch(err) {
                 this.error(err,msg);                          
             }
         });
         node.on("close", function() {
-            node.port.closeSync();
+            if (node.client) {
+                node.client.close();
+            } else {
+                node.port.closeSync();
+            }
         });
     }
     RED.nodes.registerType("16inpind", OptoInputNode);
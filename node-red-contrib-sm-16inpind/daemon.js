@@ -0,0 +1,120 @@
+"use strict";
+// Client for the 16inpindd resident bus server (16inpind -daemon), see
+// src/daemon.h for the protocol. Requests are pipelined, the responses
+// come back in order with the tag of their request. A lost connection
+// (daemon restart) is opened again in the background, with backoff.
+const net = require("net");
+
+const SOCKET = "/run/16inpind.sock";
+const DEVICE_ADDRESS = 0x20;
+const OP_READ = 1;
+const REQ_SIZE = 8;
+const RESP_SIZE = 6;
+const RECONNECT_MS = 100;
+const RECONNECT_MAX_MS = 5000;
+
+class Client {
+    constructor(path, bus) {
+        this.path = path || process.env.SM16INPIND_SOCKET || SOCKET;
+        this.bus = (bus === undefined) ? 1 : bus;
+        this.tag = 0;
+        this.pending = [];
+        this.buf = Buffer.alloc(0);
+        this.sock = null;
+        this.timer = null;
+        this.delay = RECONNECT_MS;
+        this.closed = false;
+        this._connect();
+    }
+
+    _connect() {
+        var sock = net.createConnection(this.path);
+
+        this.timer = null;
+        this.sock = sock;
+        this.buf = Buffer.alloc(0);
+        sock.on("connect", () => { this.delay = RECONNECT_MS; });
+        sock.on("data", (data) => this._data(data));
+        // the close event that follows the error reconnects
+        sock.on("error", (err) => this._fail(err));
+        sock.on("close", () => {
+            this.sock = null;
+            this._fail(new Error("Daemon connection closed"));
+            if (!this.closed) {
+                this.timer = setTimeout(() => this._connect(), this.delay);
+                this.delay = Math.min(this.delay * 2, RECONNECT_MAX_MS);
+            }
+        });
+    }
+
+    // Read size registers starting at add, resolves with a Buffer
+    read(stack, add, size) {
+        return new Promise((resolve, reject) => {
+            if (stack < 0 || stack > 7) {
+                reject(new Error("Invalid stack level"));
+                return;
+            }
+            if (this.sock === null) {
+                reject(new Error("Daemon not connected"));
+                return;
+            }
+            this.tag = (this.tag + 1) & 0xffff;
+            var req = Buffer.alloc(REQ_SIZE);
+            req.writeUInt8(OP_READ, 0);
+            req.writeUInt8(this.bus, 1);
+            req.writeUInt8(DEVICE_ADDRESS + (stack ^ 0x07), 2);
+            req.writeUInt8(add, 3);
+            req.writeUInt8(size, 4);
+            req.writeUInt16LE(this.tag, 6);
+            this.pending.push({tag: this.tag, resolve: resolve, reject: reject});
+            this.sock.write(req);
+        });
+    }
+
+    close() {
+        this.closed = true;
+        if (this.timer !== null) {
+            clearTimeout(this.timer);
+            this.timer = null;
+        }
+        if (this.sock !== null) {
+            this.sock.end();
+        }
+    }
+
+    _data(data) {
+        this.buf = Buffer.concat([this.buf, data]);
+        while (this.buf.length >= RESP_SIZE) {
+            var status = this.buf.readUInt8(1);
+            var len = this.buf.readUInt8(2);
+            var tag = this.buf.readUInt16LE(4);
+            if (this.buf.length < RESP_SIZE + len) {
+                return;
+            }
+            var payload = Buffer.from(this.buf.subarray(RESP_SIZE, RESP_SIZE + len));
+            this.buf = this.buf.subarray(RESP_SIZE + len);
+            var p = this.pending.shift();
+            if (p === undefined || p.tag !== tag) {
+                // out of sequence, the connection can not be used any more
+                if (p !== undefined) {
+                    this.pending.unshift(p);
+                }
+                this.sock.destroy(new Error("Daemon response out of sequence"));
+                return;
+            }
+            if (status !== 0) {
+                p.reject(new Error("Daemon request failed, error " + status));
+            } else {
+                p.resolve(payload);
+            }
+        }
+    }
+
+    _fail(err) {
+        var pending = this.pending;
+        this.pending = [];
+        pending.forEach(function(p) { p.reject(err); });
+    }
+}
+
+module.exports = { Client: Client, SOCKET: SOCKET };
@@ -0,0 +1,152 @@
+"""Client for the 16inpindd resident bus server.
+
+The daemon keeps the I2C buses open and serves register reads and writes
+over a unix socket, so a request costs a socket round trip instead of a
+bus open and setup. Requests can be pipelined: send many, then collect
+the responses in order. A lost connection (daemon restart) is opened
+again by the next request, with backoff.
+"""
+import os
+import socket
+import struct
+import time
+
+import lib16inpind.lib16inpind_data as data
+
+SOCKET = "/run/16inpind.sock"
+
+OP_PING = 0
+OP_READ = 1
+OP_WRITE = 2
+
+_REQ = struct.Struct("<BBBBBBH")
+_RESP = struct.Struct("<BBBBH")
+
+RECONNECT_TRIES = 6
+RECONNECT_DELAY = 0.05  # doubled after every failed try
+
+
+class Client:
+    """Connection to the daemon.
+
+    Args:
+        path (str): Socket path, default $SM16INPIND_SOCKET or /run/16inpind.sock
+        bus (int): I2C bus of the cards
+
+    Example:
+        >>> from lib16inpind.daemon import Client
+        >>> c = Client()
+        >>> regs = c.read(0, data.I2C_MEM.INPORT_REG, 2)
+    """
+
+    def __init__(self, path=None, bus=1):
+        if path is None:
+            path = os.environ.get("SM16INPIND_SOCKET", SOCKET)
+        self.path = path
+        self.bus = bus
+        self.sock = None
+        self._tag = 0
+        self._connect()
+
+    def _connect(self):
+        delay = RECONNECT_DELAY
+        for i in range(RECONNECT_TRIES):
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            try:
+                sock.connect(self.path)
+                self.sock = sock
+                return
+            except OSError:
+                sock.close()
+                if i == RECONNECT_TRIES - 1:
+                    raise
+                time.sleep(delay)
+                delay *= 2
+
+    def _send(self, buf):
+        if self.sock is None:
+            self._connect()
+        try:
+            self.sock.sendall(buf)
+        except OSError:
+            self.close()
+            raise
+
+    def close(self):
+        if self.sock is not None:
+            self.sock.close()
+            self.sock = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def _slave(self, stack):
+        if stack < 0 or stack > 7:
+            raise ValueError('Invalid stack level')
+        return data.DEVICE_ADDRESS + (0x07 ^ stack)
+
+    def _request(self, op, stack, add, payload=b"", size=0):
+        self._tag = (self._tag + 1) & 0xffff
+        slave = self._slave(stack) if op != OP_PING else 0
+        return _REQ.pack(op, self.bus, slave, add, size or len(payload), 0, self._tag) + payload
+
+    def _responses(self, count):
+        """All the responses of the last count requests, in order."""
+        first = (self._tag - count + 1) & 0xffff
+        return [self._response((first + i) & 0xffff) for i in range(count)]
+
+    def _recv(self, size):
+        buf = b""
+        while len(buf) < size:
+            try:
+                chunk = self.sock.recv(size - len(buf))
+            except OSError:
+                self.close()
+                raise
+            if not chunk:
+                self.close()
+                raise Exception("Daemon connection closed")
+            buf += chunk
+        return buf
+
+    def _response(self, tag):
+        op, status, size, _, rtag = _RESP.unpack(self._recv(_RESP.size))
+        payload = self._recv(size) if size else b""
+        if rtag != tag:
+            self.close()
+            raise Exception("Daemon response out of sequence")
+        return status, payload
+
+    def _check(self, responses):
+        for status, _ in responses:
+            if status != 0:
+                raise Exception("Daemon request failed, error " + str(status))
+        return [payload for _, payload in responses]
+
+    def ping(self):
+        self._send(self._request(OP_PING, 0, 0))
+        self._check(self._responses(1))
+
+    def read(self, stack, add, size):
+        """Read size registers starting at add, returns bytes."""
+        return self.read_many([(stack, add, size)])[0]
+
+    def write(self, stack, add, payload):
+        """Write the payload bytes starting at register add."""
+        self._send(self._request(OP_WRITE, stack, add, bytes(payload)))
+        self._check(self._responses(1))
+
+    def read_many(self, reads):
+        """Pipelined reads.
+
+        Args:
+            reads (list): (stack, add, size) tuples
+
+        Returns:
+            list: bytes for every read, in order
+        """
+        self._send(b"".join(self._request(OP_READ, s, a, size=n) for s, a, n in reads))
+        return self._check(self._responses(len(reads)))
@@ -0,0 +1,97 @@
+"""Reader of the shared memory snapshot published by ``16inpind -poller``.
+
+The poller samples every board and publishes the state in
+/dev/shm/16inpind. Reading it costs a memory copy: no bus access and no
+lock, so any number of processes can follow the boards state.
+"""
+import mmap
+import struct
+import time
+
+PATH = "/dev/shm/16inpind"
+BUS_DEFAULT = 1
+MAGIC = 0x31364950
+VERSION = 3  # layout of the segment, SNAP_VERSION in src/snapshot.h
+BOARD_MAX = 8
+READ_TIMEOUT = 0.1  # longest update a reader waits for, seconds
+
+_HEADER = struct.Struct("<IHHIIQQ")
+_BOARD = struct.Struct("<IIQQH2xIIIII16I8i16H16H")
+
+
+class SnapshotStale(Exception):
+    """The poller stopped in the middle of an update."""
+
+
+class Snapshot:
+    """Mapping of the snapshot segment of one bus.
+
+    Args:
+        bus (int): I2C bus of the boards, the default bus has no suffix
+
+    Example:
+        >>> from lib16inpind.snapshot import Snapshot
+        >>> snap = Snapshot()
+        >>> state = snap.read()
+        >>> print(state["board"][0]["inputs"])
+    """
+
+    def __init__(self, bus=BUS_DEFAULT):
+        path = PATH if bus == BUS_DEFAULT else PATH + "." + str(bus)
+        with open(path, "rb") as f:
+            self.mem = mmap.mmap(f.fileno(), _HEADER.size + BOARD_MAX * _BOARD.size,
+                                 prot=mmap.PROT_READ)
+
+    def close(self):
+        self.mem.close()
+
+    def _seq(self):
+        return struct.unpack_from("<I", self.mem, 8)[0]
+
+    def read(self):
+        """Consistent copy of the boards state.
+
+        Returns:
+            dict: seq, bus, period_us, time_ns, cycles and board, a list by
+            stack level of dicts with present, errors, req_ns and done_ns
+            (CLOCK_MONOTONIC_RAW of the inputs read), inputs, period_ns,
+            jitter_ns, jitter_max_ns, late_max_ns and misses (samples lost
+            to late reads) of the inputs sampling, counter, encoder, pwm
+            (0.01%) and freq (Hz); None for boards not sampled
+
+        Raises:
+            Exception: If no poller publishes the snapshot or its layout
+                version is not VERSION
+            SnapshotStale: If no consistent copy was made in READ_TIMEOUT
+        """
+        start = None
+        while True:
+            seq = self._seq()
+            if not seq & 1:
+                raw = self.mem[:]
+                if self._seq() == seq:
+                    break
+            if start is None:
+                start = time.monotonic()
+            elif time.monotonic() - start > READ_TIMEOUT:
+                raise SnapshotStale("Snapshot update not completed")
+        magic, version, bus, seq, period, time_ns, cycles = _HEADER.unpack_from(raw, 0)
+        if magic != MAGIC:
+            raise Exception("No poller running")
+        if version != VERSION:
+            raise Exception("Snapshot layout version %d, this reader knows %d" % (version, VERSION))
+        boards = []
+        for i in range(BOARD_MAX):
+            v = _BOARD.unpack_from(raw, _HEADER.size + i * _BOARD.size)
+            if not v[0] and not v[1]:
+                boards.append(None)
+                continue
+            boards.append({
+                "present": v[0], "errors": v[1], "req_ns": v[2], "done_ns": v[3],
+                "inputs": v[4], "period_ns": v[5], "jitter_ns": v[6],
+                "jitter_max_ns": v[7], "late_max_ns": v[8], "misses": v[9],
+                "counter": list(v[10:26]), "encoder": list(v[26:34]),
+                "pwm": list(v[34:50]), "freq": list(v[50:66]),
+            })
+        return {"seq": seq, "bus": bus, "period_us": period, "time_ns": time_ns,
+                "cycles": cycles, "board": boards}
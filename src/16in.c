@@ -12,14 +12,20 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <semaphore.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <time.h>
 #include <errno.h>
 
 #include "16in.h"
+#include "buslock.h"
 #include "comm.h"
+#include "daemon.h"
+#include "fanout.h"
+#include "gpio.h"
+#include "opto.h"
+#include "out.h"
+#include "snapshot.h"
 
 #define VERSION_BASE	(int)1
 #define VERSION_MAJOR	(int)1
@@ -27,9 +33,15 @@
 
 #define UNUSED(X) (void)X      /* To avoid gcc/g++ warnings */
 #define CMD_ARRAY_SIZE	7
+#define BATCH_LINE_MAX	1024
+#define BATCH_INVALID	"invalid" // record of a line naming no command
+#define BATCH_ARG_MAX	32
 
 #define THREAD_SAFE
 
+static int gStats = 0;
+static int gLockCommand = 0;
+
 const uint16_t pinMask[16] = { 0x8000, 0x4000, 0x2000, 0x1000, 0x0800, 0x0400, 0x0200, 0x0100, 
 			      0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
 void usage(void)
@@ -46,7 +58,19 @@ void usage(void)
 		}
 		i++;
 	}
-	printf("Where: <id> = Board id(stack level) = 0..7\n");
+	printf("Where: <id> = Board id(stack level) = 0..7, or <bus>:<stack> for a board on /dev/i2c-<bus>\n");
+	printf("       all or a list of stack levels 0,2,5 run the command on every board in one process\n");
+	printf("Global options: --bus=<bus>[,<bus>...] I2C bus(es) to use, default 1 or $SM16INPIND_BUS\n");
+	printf("                --retry=<count>[,<backoff us>] retries on transient bus errors, default %d,%d\n",
+		RETRY_TIMES, I2C_BACKOFF_US);
+	printf("                --timeout=<ms> adapter timeout, default %d\n", I2C_ADAPTER_TIMEOUT_MS);
+	printf("                --deadline=<us> max time of one transaction, retries included\n");
+	printf("                --transport=<i2c-dev|loop|sim|daemon> bus backend, default i2c-dev or $SM16INPIND_TRANSPORT\n");
+	printf("                --gpio=<chip>:<line>|fifo:<path> card interrupt line, default %s or $%s\n",
+		GPIO_SPEC_DEFAULT, GPIO_SPEC_ENV);
+	printf("                --lock=<transaction|command> bus lock scope, default transaction\n");
+	printf("                --format=<text|json|csv|bin> output of the results, default text\n");
+	printf("                --stats print transfer counters and latency histograms at exit\n");
 	printf("Type 16inpind -h <command> for more help\n");
 }
 
@@ -120,7 +144,7 @@ static int doRead(int argc, char *argv[])
 	dev = doBoardInit(atoi(argv[1]));
 	if (dev <= 0)
 	{
-		exit(1);
+		return ERROR;
 	}
 
 	if (argc == 4)
@@ -129,117 +153,647 @@ static int doRead(int argc, char *argv[])
 		if ( (pin < CHANNEL_NR_MIN) || (pin > CHANNEL_NR_MAX))
 		{
 			printf("Opto channel number value out of range!\n");
-			exit(1);
+			return ERROR;
 		}
 
 		if (OK != chGet(dev, pin, &state))
 		{
 			printf("Fail to read!\n");
-			exit(1);
+			return ERROR;
 		}
-		printf("%d\n", state);
+		outText("%d\n", state);
+		outInt("channel", pin);
+		outInt("state", state);
 	}
 	else if (argc == 3)
 	{
 		if (OK != chGet(dev, 0, &state))
 		{
 			printf("Fail to read!\n");
-			exit(1);
+			return ERROR;
 		}
-		printf("%d\n", state);
+		outText("%d\n", state);
+		outInt("inputs", state);
 	}
 	else
 	{
 		printf("%s", CMD_READ.usage);
-		exit(1);
+		return ERROR;
 	}
 	return 0;
 }
-#define TIMEOUT_S 5
-//#define DEBUG_SEM
-int waitForI2C(sem_t *sem)
-{
-  int semVal = 2;
-  struct timespec ts;
-  int s = 0;
-  
-#ifdef DEBUG_SEM
-	sem_getvalue(sem, &semVal);
-	printf("Semaphore initial value %d\n", semVal);
-	semVal = 2;
-#endif
-	while (semVal > 0)
-	{
-    if (clock_gettime(CLOCK_REALTIME, &ts) == -1)
-    {
-        /* handle error */
-        printf("Fail to read time \n");
-        return -1;
-    }
-    ts.tv_sec += TIMEOUT_S;
-    while ((s = sem_timedwait(sem, &ts)) == -1 && errno == EINTR)
-               continue;       /* Restart if interrupted by handler */
-		sem_getvalue(sem, &semVal);
-	}
-#ifdef DEBUG_SEM
-	sem_getvalue(sem, &semVal);
-	printf("Semaphore after wait %d\n", semVal);
+#ifdef THREAD_SAFE
+// Group the whole command under one lock of the selected buses, taken in
+// ascending order. A failed lock releases the buses already taken.
+static int busLockAll(int lock)
+{
+	int bus[I2C_BUS_MAX];
+	int count = i2cBusGet(bus, I2C_BUS_MAX);
+	int i;
+	int j;
+
+	for (i = 0; i < I2C_BUS_MAX; i++)
+	{
+		for (j = 0; j < count; j++)
+		{
+			if (bus[j] != i)
+			{
+				continue;
+			}
+			if (!lock)
+			{
+				i2cGroupEnd(i);
+			}
+			else if (i2cGroupBegin(i) != OK)
+			{
+				for (i--; i >= 0; i--)
+				{
+					for (j = 0; j < count; j++)
+					{
+						if (bus[j] == i)
+						{
+							i2cGroupEnd(i);
+						}
+					}
+				}
+				return ERROR;
+			}
+			break;
+		}
+	}
+	return OK;
+}
 #endif
-  return 0;
+
+// Comma separated list of integers in [0..max)
+static int intListParse(const char* str, int* val, int size, int max)
+{
+	int count = 0;
+	char* end = NULL;
+
+	while ( (*str != 0) && (count < size))
+	{
+		val[count] = (int)strtol(str, &end, 10);
+		if ( (end == str) || (val[count] < 0) || (val[count] >= max))
+		{
+			return -1;
+		}
+		count++;
+		str = end;
+		if (*str == ',')
+		{
+			str++;
+		}
+	}
+	return count;
 }
 
-int releaseI2C(sem_t *sem)
+// Select the bus of an "<bus>:<stack>" board id, returns argc or -1
+static int boardPrefix(int argc, char *argv[])
 {
-  int semVal = 2;
-  sem_getvalue(sem, &semVal);
-	if (semVal < 1)
+	int bus = 0;
+	char* sep = NULL;
+
+	if (argc > 2)
 	{
-		 if (sem_post(sem) == -1)
-		 {
-			 printf("Fail to post SMI2C_SEM \n");
-       return -1;
-		 }
+		sep = strchr(argv[1], ':');
+		if (sep != NULL)
+		{
+			*sep = 0;
+			if (intListParse(argv[1], &bus, 1, I2C_BUS_MAX) != 1)
+			{
+				printf("Invalid I2C bus [0..%d]!\n", I2C_BUS_MAX - 1);
+				return -1;
+			}
+			i2cBusSet(&bus, 1);
+			argv[1] = sep + 1;
+		}
 	}
-#ifdef DEBUG_SEM
-	sem_getvalue(sem, &semVal);
-	printf("Semaphore after post %d\n", semVal);
-#endif
-return 0;
+	return argc;
 }
 
-int main(int argc, char *argv[])
+/*
+ * Consume the global options placed in front of the command and the
+ * optional "<bus>:" prefix of the board id. Returns the new argc.
+ */
+static int globalOptions(int argc, char *argv[])
 {
+	int bus[I2C_BUS_MAX];
+	int count = 0;
 	int i = 0;
 
-	if (argc == 1)
+	while ( (argc > 1) && (strncmp(argv[1], "--", 2) == 0))
 	{
-		usage();
-		return -1;
+		if (strncmp(argv[1], "--bus=", 6) == 0)
+		{
+			count = intListParse(argv[1] + 6, bus, I2C_BUS_MAX, I2C_BUS_MAX);
+			if (count <= 0)
+			{
+				printf("Invalid I2C bus list [0..%d]!\n", I2C_BUS_MAX - 1);
+				return -1;
+			}
+			i2cBusSet(bus, count);
+		}
+		else if (strncmp(argv[1], "--retry=", 8) == 0)
+		{
+			I2cRetryType retry;
+
+			i2cRetryGet(&retry);
+			count = intListParse(argv[1] + 8, bus, 2, 1000000);
+			if (count <= 0)
+			{
+				printf("Invalid retry option, use --retry=<count>[,<backoff us>]\n");
+				return -1;
+			}
+			retry.retries = bus[0];
+			if (count > 1)
+			{
+				retry.backoffUs = bus[1];
+			}
+			i2cRetrySet(&retry);
+		}
+		else if (strncmp(argv[1], "--timeout=", 10) == 0)
+		{
+			if (intListParse(argv[1] + 10, bus, 1, 1000000) != 1)
+			{
+				printf("Invalid timeout option, use --timeout=<ms>\n");
+				return -1;
+			}
+			i2cAdapterSet(bus[0], -1);
+		}
+		else if (strncmp(argv[1], "--deadline=", 11) == 0)
+		{
+			if (intListParse(argv[1] + 11, bus, 1, 100000000) != 1)
+			{
+				printf("Invalid deadline option, use --deadline=<us>\n");
+				return -1;
+			}
+			i2cDeadlineSet(bus[0]);
+		}
+		else if (strncmp(argv[1], "--transport=", 12) == 0)
+		{
+			if (i2cTransportSet(argv[1] + 12) != 0)
+			{
+				printf("Invalid transport %s, use i2c-dev, loop, sim or daemon\n", argv[1] + 12);
+				return -1;
+			}
+		}
+		else if (strncmp(argv[1], "--gpio=", 7) == 0)
+		{
+			gpioEventSpecSet(argv[1] + 7);
+		}
+		else if (strncmp(argv[1], "--lock=", 7) == 0)
+		{
+			if (strcmp(argv[1] + 7, "command") == 0)
+			{
+				gLockCommand = 1;
+			}
+			else if (strcmp(argv[1] + 7, "transaction") != 0)
+			{
+				printf("Invalid lock option, use --lock=<transaction|command>\n");
+				return -1;
+			}
+		}
+		else if (strncmp(argv[1], "--format=", 9) == 0)
+		{
+			if (outFormatSet(argv[1] + 9) != OK)
+			{
+				printf("Invalid output format %s, use text, json, csv or bin\n", argv[1] + 9);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[1], "--stats") == 0)
+		{
+			gStats = 1;
+		}
+		else
+		{
+			printf("Invalid global option %s\n", argv[1]);
+			return -1;
+		}
+		for (i = 1; i < argc - 1; i++)
+		{
+			argv[i] = argv[i + 1];
+		}
+		argc--;
+	}
+	return boardPrefix(argc, argv);
+}
+
+// commands never run under a command wide lock (--lock=command)
+static const CliCmdType* gNoLockCmd[] =
+{
+	&CMD_DAEMON,
+	&CMD_POLLER,
+	&CMD_LOCK_STAT,
+	&CMD_BATCH,
+
+	0
+};
+
+// resident modes and waits without end, they would never give the batch back
+static const CliCmdType* gNoBatchCmd[] =
+{
+	&CMD_DAEMON,
+	&CMD_POLLER,
+	&CMD_BATCH,
+	&CMD_WATCH,
+	&CMD_OPTO_WAIT,
+
+	0
+};
+
+static const CliCmdType* cmdFind(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 0; NULL != gCmdArray[i]; i++)
+	{
+		if ( (gCmdArray[i]->name != NULL) && (gCmdArray[i]->namePos < argc)
+			&& (strcasecmp(argv[gCmdArray[i]->namePos], gCmdArray[i]->name) == 0))
+		{
+			return gCmdArray[i];
+		}
 	}
+	return NULL;
+}
+
+// One result record per command, the board is the "<id>" of its line
+static int cmdCall(const CliCmdType* cmd, int argc, char *argv[])
+{
+	int bus = -1;
+	int stack = -1;
+	int ret;
+
+	if (cmd->namePos == 2)
+	{
+		i2cBusGet(&bus, 1);
+		stack = atoi(argv[1]);
+	}
+	outBegin(cmd->name, bus, stack);
+	ret = cmd->pFunc(argc, argv);
+	outEnd(ret);
+	return ret;
+}
+
+// Record without a board: batch lines running no command, failed locks and fan-outs
+static int cmdStatus(const char* name, int ret)
+{
+	outBegin(name, -1, -1);
+	outEnd(ret);
+	return ret;
+}
+
+static int cmdRun(const CliCmdType* cmd, int argc, char *argv[])
+{
+	int ret;
+
 #ifdef THREAD_SAFE
-	sem_t *semaphore = sem_open("/SMI2C_SEM", O_CREAT, 0000666, 1);//sem_open("/SMI2C_SEM", O_CREAT);
-	waitForI2C(semaphore);
+	if (gLockCommand && (busLockAll(1) != OK))
+	{
+		printf("Fail to lock the bus\n");
+		return cmdStatus(cmd->name, ERROR);
+	}
 #endif
-	while (NULL != gCmdArray[i])
+	ret = cmdCall(cmd, argc, argv);
+#ifdef THREAD_SAFE
+	if (gLockCommand)
 	{
-		if ( (gCmdArray[i]->name != NULL) && (gCmdArray[i]->namePos < argc))
+		busLockAll(0);
+	}
+#endif
+	return ret;
+}
+
+// they wait on one board, they would never get to the next one
+static const CliCmdType* gNoFanoutCmd[] =
+{
+	&CMD_OPTO_WAIT,
+	&CMD_WATCH,
+
+	0
+};
+
+/*
+ * "all" or "0,2,5" in place of the board id: the command runs on every
+ * target board, the registers it reads are prefetched for all the boards
+ * in one frame per bus, under the bus lock. One record per board, in
+ * text every board output is prefixed by its id. Returns ERROR if the
+ * command failed on any board.
+ */
+static int cmdFanout(const CliCmdType* cmd, int argc, char *argv[])
+{
+	static FanoutBoardType board[FANOUT_BOARD_MAX];
+	int bus[I2C_BUS_MAX];
+	int busCount = i2cBusGet(bus, I2C_BUS_MAX);
+	char* id = argv[1];
+	char stack[4];
+	int multiBus = 0;
+	int count;
+	int ret = OK;
+	int i;
+
+	for (i = 0; gNoFanoutCmd[i] != NULL; i++)
+	{
+		if (cmd == gNoFanoutCmd[i])
 		{
-			if (strcasecmp(argv[gCmdArray[i]->namePos], gCmdArray[i]->name) == 0)
+			printf("%s runs on one board only\n", cmd->name);
+			return cmdStatus(cmd->name, ERROR);
+		}
+	}
+	count = fanoutBoards(id, board, FANOUT_BOARD_MAX);
+	if (count < 0)
+	{
+		printf("Invalid board list %s, stack levels 0..7 separated by commas\n", id);
+		return cmdStatus(cmd->name, ERROR);
+	}
+	if (count == 0)
+	{
+		printf("No board detected\n");
+		return cmdStatus(cmd->name, ERROR);
+	}
+	for (i = 1; i < count; i++)
+	{
+		multiBus |= board[i].bus != board[0].bus;
+	}
+	if (fanoutBegin(cmd->name, board, count) != OK)
+	{
+		printf("Fail to lock the bus\n");
+		return cmdStatus(cmd->name, ERROR);
+	}
+	for (i = 0; i < count; i++)
+	{
+		i2cBusSet(&board[i].bus, 1);
+		snprintf(stack, sizeof(stack), "%d", board[i].stack);
+		argv[1] = stack;
+		if (multiBus)
+		{
+			outText("%d:%d: ", board[i].bus, board[i].stack);
+		}
+		else
+		{
+			outText("%d: ", board[i].stack);
+		}
+		if (cmdRun(cmd, argc, argv) != OK)
+		{
+			ret = ERROR;
+		}
+		fflush(stdout);
+	}
+	fanoutEnd(board, count);
+	argv[1] = id;
+	i2cBusSet(bus, busCount);
+	return ret;
+}
+
+// One board or the fan-out of a board list
+static int cmdDispatch(const CliCmdType* cmd, int argc, char *argv[])
+{
+	if ( (cmd->namePos == 2) && fanoutIs(argv[1]))
+	{
+		return cmdFanout(cmd, argc, argv);
+	}
+	return cmdRun(cmd, argc, argv);
+}
+
+static int doBatch(int argc, char *argv[]);
+const CliCmdType CMD_BATCH =
+{
+	"-batch",
+	1,
+	&doBatch,
+	"  -batch           Run the commands read from a file or stdin, one per line, in one process\n",
+	"  Usage:           16inpind -batch [<file>]\n"
+	"                   Lines: [16inpind] <id> <command> [<args>], lock / unlock hold the bus lock\n"
+	"                   over the commands in between, # starts a comment\n",
+	"  Example:         16inpind -batch script.txt; Run the commands of script.txt, the buses stay open\n"
+};
+
+/*
+ * Split one batch line in argv[1..], argv[0] is kept. Returns argc, 0
+ * for an empty line and -1 if it has too many words.
+ */
+static int batchSplit(char* line, char *argv[], int size)
+{
+	char* save = NULL;
+	char* word;
+	int argc = 1;
+
+	for (word = strtok_r(line, " \t\r\n", &save); word != NULL;
+		word = strtok_r(NULL, " \t\r\n", &save))
+	{
+		if (word[0] == '#')
+		{
+			break;
+		}
+		if ( (argc == 1) && (strcmp(word, "16inpind") == 0))
+		{
+			continue;
+		}
+		if (argc >= size)
+		{
+			return -1;
+		}
+		argv[argc++] = word;
+	}
+	return argc == 1 ? 0 : argc;
+}
+
+// The file is opened with the ids of the caller, not those of a setuid run
+static FILE* batchOpen(const char* path)
+{
+	uid_t euid = geteuid();
+	gid_t egid = getegid();
+	FILE* f = NULL;
+
+	if ( (setegid(getgid()) == 0) && (seteuid(getuid()) == 0))
+	{
+		f = fopen(path, "r");
+	}
+	if ( (seteuid(euid) != 0) || (setegid(egid) != 0))
+	{
+		printf("Fail to restore the privileges\n");
+		if (NULL != f)
+		{
+			fclose(f);
+		}
+		return NULL;
+	}
+	return f;
+}
+
+static int batchLine(int no, int argc, char *argv[], int* locked)
+{
+	const CliCmdType* cmd;
+	int i;
+
+	if (strcasecmp(argv[1], "lock") == 0)
+	{
+		if (*locked)
+		{
+			fprintf(stderr, "Line %d: the bus lock is already held\n", no);
+			return cmdStatus("lock", ERROR);
+		}
+		if (busLockAll(1) != OK)
+		{
+			fprintf(stderr, "Line %d: fail to lock the bus\n", no);
+			return cmdStatus("lock", ERROR);
+		}
+		*locked = 1;
+		return cmdStatus("lock", OK);
+	}
+	if (strcasecmp(argv[1], "unlock") == 0)
+	{
+		if (!*locked)
+		{
+			fprintf(stderr, "Line %d: the bus lock is not held\n", no);
+			return cmdStatus("unlock", ERROR);
+		}
+		busLockAll(0);
+		*locked = 0;
+		return cmdStatus("unlock", OK);
+	}
+	if (strncmp(argv[1], "--", 2) == 0)
+	{
+		fprintf(stderr, "Line %d: global options go in front of -batch\n", no);
+		return cmdStatus(BATCH_INVALID, ERROR);
+	}
+	if (boardPrefix(argc, argv) < 0)
+	{
+		return cmdStatus(BATCH_INVALID, ERROR);
+	}
+	cmd = cmdFind(argc, argv);
+	for (i = 0; (cmd != NULL) && (gNoBatchCmd[i] != NULL); i++)
+	{
+		if (cmd == gNoBatchCmd[i])
+		{
+			fprintf(stderr, "Line %d: %s can not run in a batch\n", no, cmd->name);
+			return cmdStatus(cmd->name, ERROR);
+		}
+	}
+	if (NULL == cmd)
+	{
+		fprintf(stderr, "Line %d: invalid command option\n", no);
+		return cmdStatus(BATCH_INVALID, ERROR);
+	}
+	return cmdDispatch(cmd, argc, argv);
+}
+
+/*
+ * The buses and the boards stay open from one line to the next, a failed
+ * line does not stop the batch. Returns ERROR if any line failed.
+ */
+static int doBatch(int argc, char *argv[])
+{
+	static char line[BATCH_LINE_MAX];
+	char* args[BATCH_ARG_MAX];
+	int bus[I2C_BUS_MAX];
+	int busCount;
+	FILE* f = stdin;
+	int locked = 0;
+	int failed = 0;
+	int no = 0;
+	int n;
+
+	if (argc > 3)
+	{
+		printf("%s", CMD_BATCH.usage);
+		return ERROR;
+	}
+	if (argc == 3)
+	{
+		f = batchOpen(argv[2]);
+		if (NULL == f)
+		{
+			printf("Fail to open %s\n", argv[2]);
+			return ERROR;
+		}
+	}
+	busCount = i2cBusGet(bus, I2C_BUS_MAX);
+	args[0] = argv[0];
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		no++;
+		n = batchSplit(line, args, BATCH_ARG_MAX);
+		if (n == 0)
+		{
+			continue;
+		}
+		if ( (n < 0) || (batchLine(no, n, args, &locked) != OK))
+		{
+			if (n < 0)
 			{
-				gCmdArray[i]->pFunc(argc, argv);
-#ifdef THREAD_SAFE
-				releaseI2C(semaphore);
-#endif
+				fprintf(stderr, "Line %d: too many arguments\n", no);
+				cmdStatus(BATCH_INVALID, ERROR);
+			}
+			failed++;
+		}
+		// a "<bus>:<stack>" id selects the bus of its line only
+		i2cBusSet(bus, busCount);
+		fflush(stdout);
+	}
+	if (locked)
+	{
+		busLockAll(0);
+	}
+	if (f != stdin)
+	{
+		fclose(f);
+	}
+	if (gStats)
+	{
+		i2cStatsPrint(stdout);
+	}
+	i2cClose();
+	return failed ? ERROR : OK;
+}
+
+int main(int argc, char *argv[])
+{
+	const CliCmdType* cmd;
+	int ret;
+	int i = 0;
 
-				return 0;
+	argc = globalOptions(argc, argv);
+	if (argc < 0)
+	{
+		return -1;
+	}
+	// the resident modes run for the whole life of the process: never under
+	// a command wide lock, each transfer locks the bus on its own
+	if (daemonInvoked(argv[0]))
+	{
+		return doDaemon(argc, argv);
+	}
+	for (i = 0; (argc > 1) && (gNoLockCmd[i] != NULL); i++)
+	{
+		if (strcasecmp(argv[1], gNoLockCmd[i]->name) == 0)
+		{
+			// every line of a batch has its own record
+			if (gNoLockCmd[i] == &CMD_BATCH)
+			{
+				return doBatch(argc, argv) == OK ? 0 : 1;
 			}
+			return cmdCall(gNoLockCmd[i], argc, argv) == OK ? 0 : 1;
 		}
-		i++;
 	}
-	printf("Invalid command option\n");
-	usage();
-#ifdef THREAD_SAFE
-	releaseI2C(semaphore);
-#endif
-	return -1;
+	if (argc == 1)
+	{
+		usage();
+		return -1;
+	}
+	cmd = cmdFind(argc, argv);
+	if (NULL == cmd)
+	{
+		printf("Invalid command option\n");
+		usage();
+		return -1;
+	}
+	ret = cmdDispatch(cmd, argc, argv);
+	if (gStats)
+	{
+		i2cStatsPrint(stdout);
+	}
+	i2cClose();
+	return ret == OK ? 0 : 1;
 }
@@ -6,7 +6,6 @@
 
 #define	UNU	__attribute__((unused))
 
-#define RETRY_TIMES	10
 #define INPUTS16_INPORT_REG_ADD	0x00
 #define INPUTS16_OUTPORT_REG_ADD	0x02
 #define INPUTS16_POLINV_REG_ADD	0x04
@@ -31,5 +30,6 @@ typedef enum
 } OutStateEnumType;
 
 extern const CliCmdType CMD_READ;
+extern const CliCmdType CMD_BATCH;
 
 #endif //IN_16_H_
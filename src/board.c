@@ -1,6 +1,7 @@
 #include "board.h"
 #include "comm.h"
 #include "data.h"
+#include "out.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -33,7 +34,7 @@ static int doHelp(int argc, char *argv[])
 			{
 				if (strcasecmp(argv[2], gCmdArray[i]->name) == 0)
 				{
-					printf("%s%s%s", gCmdArray[i]->help, gCmdArray[i]->usage,
+					outText("%s%s%s", gCmdArray[i]->help, gCmdArray[i]->usage,
 						gCmdArray[i]->example);
 					break;
 				}
@@ -48,7 +49,7 @@ static int doHelp(int argc, char *argv[])
 			{
 				if (gCmdArray[i]->name != NULL)
 				{
-					printf("%s", gCmdArray[i]->help);
+					outText("%s", gCmdArray[i]->help);
 					break;
 				}
 				i++;
@@ -62,7 +63,7 @@ static int doHelp(int argc, char *argv[])
 		{
 			if (gCmdArray[i]->name != NULL)
 			{
-				printf("%s", gCmdArray[i]->help);
+				outText("%s", gCmdArray[i]->help);
 			}
 			i++;
 		}
@@ -82,13 +83,18 @@ const CliCmdType CMD_VERSION =
 
 static int doVersion(int argc, char *argv[])
 {
+	char version[16];
+
 	(void)argc;
 	(void)argv;
-	printf(
+	outText(
 		"16inpind command line interface v%d.%d.%d Copyright (c) 2016 - 2025 Sequent Microsystems\n",
 		VERSION_BASE, VERSION_MAJOR, VERSION_MINOR);
-	printf("\nThis is free software with ABSOLUTELY NO WARRANTY.\n");
-	printf("For details type: 16inpind -warranty\n");
+	outText("\nThis is free software with ABSOLUTELY NO WARRANTY.\n");
+	outText("For details type: 16inpind -warranty\n");
+	snprintf(version, sizeof(version), "%d.%d.%d", VERSION_BASE, VERSION_MAJOR,
+		VERSION_MINOR);
+	outStr("version", version);
 	return 0;
 }
 char *warranty =
@@ -121,7 +127,7 @@ static int doWarranty(int argc, char* argv[])
 {
 	(void)argc;
 	(void)argv;
-	printf("%s\n", warranty);
+	outText("%s\n", warranty);
 	return 0;
 }
 
@@ -135,9 +141,19 @@ const CliCmdType CMD_LIST =
 	"  Usage:           16inpind -list\n",
 	"  Example:         16inpind -list display: 1,0 \n"};
 int boardCheck(int stack)
+{
+	int bus = 0;
+
+	i2cBusGet(&bus, 1);
+	return boardCheckBus(bus, stack);
+}
+
+int boardCheckBus(int bus, int stack)
 {
 	int dev = 0;
 	int add = 0;
+	int probe = 0;
+	int ret = OK;
 	uint8_t buff[8];
 
 	if ( (stack < 0) || (stack > 7))
@@ -146,46 +162,83 @@ int boardCheck(int stack)
 		return ERROR;
 	}
 	add = (stack + INPUT16_HW_I2C_BASE_ADD) ^ 0x07;
-	dev = i2cSetup(add);
+	dev = i2cSetupBus(bus, add);
 	if (dev == -1)
 	{
 		return ERROR;
 	}
+	// an empty stack level answers with a NACK at once, no retry
+	probe = i2cProbeSet(1);
 	if (ERROR == i2cMem8Read(dev, INPUTS16_INPORT_REG_ADD, buff, 2))
 	{
-		return ERROR;
+		ret = ERROR;
 	}
-	return OK;
+	i2cProbeSet(probe);
+	return ret;
 }
 
-static int doList(int argc, char *argv[])
+typedef struct
 {
-	int ids[8];
+	int ids[I2C_BUS_MAX][8];
+	int cnt[I2C_BUS_MAX];
+} ListResultType;
+
+static void listBus(int bus, void* arg)
+{
+	ListResultType* res = (ListResultType*)arg;
 	int i;
+
+	res->cnt[bus] = 0;
+	for (i = 0; i < 8; i++)
+	{
+		if (boardCheckBus(bus, i) == OK)
+		{
+			res->ids[bus][res->cnt[bus]] = i;
+			res->cnt[bus]++;
+		}
+	}
+}
+
+static int doList(int argc, char *argv[])
+{
+	static ListResultType res;
+	int bus[I2C_BUS_MAX];
+	int busCount = 0;
 	int cnt = 0;
+	int i;
 
 	(void)argc;
 	(void)argv;
 
-	for (i = 0; i < 8; i++)
+	// every bus is scanned by its own worker
+	busCount = i2cBusGet(bus, I2C_BUS_MAX);
+	i2cBusWorkersRun(bus, busCount, listBus, &res);
+	for (i = 0; i < busCount; i++)
 	{
-		if (boardCheck(i) == OK)
+		cnt = res.cnt[bus[i]];
+		if (busCount > 1)
 		{
-			ids[cnt] = i;
-			cnt++;
+			outText("Bus %d: ", bus[i]);
 		}
+		outText("%d board(s) detected\n", cnt);
+		if (cnt > 0)
+		{
+			outText("Id:");
+		}
+		// one record per bus
+		outInt("bus", bus[i]);
+		outInt("count", cnt);
+		outArrayBegin("ids");
+		while (cnt > 0)
+		{
+			cnt--;
+			outText(" %d", res.ids[bus[i]][cnt]);
+			outInt(NULL, res.ids[bus[i]][cnt]);
+		}
+		outArrayEnd();
+		outText("\n");
+		outRecord(OK);
 	}
-	printf("%d board(s) detected\n", cnt);
-	if (cnt > 0)
-	{
-		printf("Id:");
-	}
-	while (cnt > 0)
-	{
-		cnt--;
-		printf(" %d", ids[cnt]);
-	}
-	printf("\n");
 	return 0;
 }
 
@@ -216,7 +269,9 @@ static int doBoard(int argc, char *argv[])
 		{
 			return ERROR;
 		}
-		printf("Sixteen LV Digital Inputs firmware version %d.%02d\n", (int)buff[0], (int)buff[1]);
+		outText("Sixteen LV Digital Inputs firmware version %d.%02d\n", (int)buff[0], (int)buff[1]);
+		outInt("fw_major", buff[0]);
+		outInt("fw_minor", buff[1]);
 	}
 	else
 	{
@@ -9,4 +9,7 @@ extern const CliCmdType CMD_WAR;
 extern const CliCmdType CMD_LIST;
 extern const CliCmdType CMD_BOARD;
 
+int boardCheck(int stack);
+int boardCheckBus(int bus, int stack);
+
 #endif //BOARD_H_
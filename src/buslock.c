@@ -0,0 +1,396 @@
+/*
+ * buslock.c:
+ *	Per bus lock shared by every process using the card. A ticket queue
+ *	in shared memory, guarded by a robust mutex, gives the bus to the
+ *	waiters in arrival order; holders and waiters that died are skipped.
+ *	On the bus of the other Sequent tools the /SMI2C_SEM semaphore they
+ *	use is taken around the queue, so both keep excluding each other.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "buslock.h"
+#include "comm.h"
+#include "data.h"
+#include "out.h"
+
+#define BUS_LOCK_MAGIC	0x4c4b3136 // "16KL"
+#define BUS_LOCK_VERSION	1 // layout of BusLockShmType
+#define BUS_LOCK_QUEUE	64
+#define BUS_LOCK_POLL_MS	100 // liveness check of the holder while waiting
+#define BUS_LOCK_INIT_MS	1000
+#define BUS_LOCK_SEM	"/SMI2C_SEM" // lock of the other Sequent tools
+#define BUS_LOCK_SEM_BUS	1 // the bus they use
+#define BUS_LOCK_SEM_TIMEOUT_S	5 // a holder that died never posts: go on
+
+typedef struct
+{
+	pthread_mutex_t mutex; // guards the fields below
+	pthread_cond_t cond;
+	uint32_t next; // next ticket
+	uint32_t serving; // ticket owning the bus
+	int32_t waiter[BUS_LOCK_QUEUE]; // PID by ticket
+	uint64_t holdStartNs;
+	BusLockStatsType stats;
+} BusLockType;
+
+typedef struct
+{
+	uint32_t magic; // set last, once the rest is initialized
+	uint32_t version;
+	uint32_t size; // sizeof(BusLockShmType)
+	BusLockType bus[I2C_BUS_MAX];
+} BusLockShmType;
+
+static BusLockShmType* gBusLockShm = NULL;
+static pthread_mutex_t gBusLockMapLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int gBusLockDepth[I2C_BUS_MAX];
+static __thread int gBusLockSemHeld = 0;
+static sem_t* gBusLockSem = NULL;
+
+static uint64_t busLockNowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int busLockDead(int32_t pid)
+{
+	return (pid > 0) && (kill(pid, 0) == -1) && (errno == ESRCH);
+}
+
+static void busLockInit(BusLockShmType* shm)
+{
+	pthread_mutexattr_t ma;
+	pthread_condattr_t ca;
+	int i;
+
+	pthread_mutexattr_init(&ma);
+	pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+	pthread_condattr_init(&ca);
+	pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	memset(shm->bus, 0, sizeof(shm->bus));
+	for (i = 0; i < I2C_BUS_MAX; i++)
+	{
+		pthread_mutex_init(&shm->bus[i].mutex, &ma);
+		pthread_cond_init(&shm->bus[i].cond, &ca);
+	}
+	pthread_mutexattr_destroy(&ma);
+	pthread_condattr_destroy(&ca);
+	shm->version = BUS_LOCK_VERSION;
+	shm->size = sizeof(BusLockShmType);
+	__atomic_store_n(&shm->magic, BUS_LOCK_MAGIC, __ATOMIC_RELEASE);
+}
+
+// Map the lock segment, the process creating it initializes it
+static BusLockShmType* busLockMap(void)
+{
+	BusLockShmType* shm;
+	int create = 1;
+	int fd;
+	int i;
+
+	pthread_mutex_lock(&gBusLockMapLock);
+	if (gBusLockShm != NULL)
+	{
+		pthread_mutex_unlock(&gBusLockMapLock);
+		return gBusLockShm;
+	}
+	fd = shm_open(BUS_LOCK_SHM, O_CREAT | O_EXCL | O_RDWR, 0666);
+	if ( (fd < 0) && (errno == EEXIST))
+	{
+		create = 0;
+		fd = shm_open(BUS_LOCK_SHM, O_RDWR, 0);
+	}
+	if (fd < 0)
+	{
+		pthread_mutex_unlock(&gBusLockMapLock);
+		return NULL;
+	}
+	if (create)
+	{
+		fchmod(fd, 0666);
+	}
+	if (ftruncate(fd, sizeof(BusLockShmType)) < 0)
+	{
+		close(fd);
+		pthread_mutex_unlock(&gBusLockMapLock);
+		return NULL;
+	}
+	shm = mmap(NULL, sizeof(BusLockShmType), PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+	{
+		pthread_mutex_unlock(&gBusLockMapLock);
+		return NULL;
+	}
+	if (create)
+	{
+		busLockInit(shm);
+	}
+	// the creator died before the end of the initialization: redo it
+	for (i = 0; __atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != BUS_LOCK_MAGIC;
+		i++)
+	{
+		if (i >= BUS_LOCK_INIT_MS)
+		{
+			busLockInit(shm);
+			break;
+		}
+		usleep(1000);
+	}
+	// left by a build with another layout
+	if ( (shm->version != BUS_LOCK_VERSION)
+		|| (shm->size != sizeof(BusLockShmType)))
+	{
+		busLockInit(shm);
+	}
+	gBusLockShm = shm;
+	pthread_mutex_unlock(&gBusLockMapLock);
+	return shm;
+}
+
+static BusLockType* busLockGet(int bus)
+{
+	BusLockShmType* shm;
+
+	if ( (bus < 0) || (bus >= I2C_BUS_MAX))
+	{
+		return NULL;
+	}
+	shm = busLockMap();
+	return shm == NULL ? NULL : &shm->bus[bus];
+}
+
+static void busLockMutex(BusLockType* l)
+{
+	if (pthread_mutex_lock(&l->mutex) == EOWNERDEAD)
+	{
+		pthread_mutex_consistent(&l->mutex);
+	}
+}
+
+// Skip the ticket being served if its process is gone
+static void busLockRecover(BusLockType* l)
+{
+	int32_t pid = l->stats.holder;
+
+	if (pid == 0)
+	{
+		pid = l->waiter[l->serving % BUS_LOCK_QUEUE];
+	}
+	if ( (l->serving != l->next) && busLockDead(pid))
+	{
+		l->stats.holder = 0;
+		l->serving++;
+		l->stats.recoveries++;
+		pthread_cond_broadcast(&l->cond);
+	}
+}
+
+static void busLockWait(BusLockType* l)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_nsec += BUS_LOCK_POLL_MS * 1000000L;
+	if (ts.tv_nsec >= 1000000000L)
+	{
+		ts.tv_nsec -= 1000000000L;
+		ts.tv_sec++;
+	}
+	if (pthread_cond_timedwait(&l->cond, &l->mutex, &ts) == EOWNERDEAD)
+	{
+		pthread_mutex_consistent(&l->mutex);
+	}
+}
+
+// Wait for /SMI2C_SEM like the other tools do, at most BUS_LOCK_SEM_TIMEOUT_S
+static void busLockSemWait(void)
+{
+	struct timespec ts;
+	int ret;
+
+	pthread_mutex_lock(&gBusLockMapLock);
+	if (NULL == gBusLockSem)
+	{
+		gBusLockSem = sem_open(BUS_LOCK_SEM, O_CREAT, 0666, 1);
+		if (gBusLockSem == SEM_FAILED)
+		{
+			gBusLockSem = NULL;
+		}
+	}
+	pthread_mutex_unlock(&gBusLockMapLock);
+	if (NULL == gBusLockSem)
+	{
+		return;
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += BUS_LOCK_SEM_TIMEOUT_S;
+	while ( (ret = sem_timedwait(gBusLockSem, &ts)) == -1 && (errno == EINTR))
+		;
+	gBusLockSemHeld = ret == 0;
+}
+
+int busLock(int bus)
+{
+	BusLockType* l = busLockGet(bus);
+	uint64_t start = busLockNowNs();
+	uint64_t wait;
+	uint32_t ticket;
+
+	if (NULL == l)
+	{
+		return ERROR;
+	}
+	if (gBusLockDepth[bus]++ > 0)
+	{
+		return OK;
+	}
+	if (bus == BUS_LOCK_SEM_BUS)
+	{
+		busLockSemWait();
+	}
+	busLockMutex(l);
+	while (l->next - l->serving >= BUS_LOCK_QUEUE)
+	{
+		busLockRecover(l);
+		busLockWait(l);
+	}
+	ticket = l->next++;
+	l->waiter[ticket % BUS_LOCK_QUEUE] = getpid();
+	if (l->serving != ticket)
+	{
+		l->stats.contended++;
+	}
+	while (l->serving != ticket)
+	{
+		busLockRecover(l);
+		busLockWait(l);
+	}
+	l->stats.holder = getpid();
+	l->holdStartNs = busLockNowNs();
+	wait = l->holdStartNs - start;
+	l->stats.count++;
+	l->stats.waitNs += wait;
+	if (wait > l->stats.waitMaxNs)
+	{
+		l->stats.waitMaxNs = wait;
+	}
+	pthread_mutex_unlock(&l->mutex);
+	return OK;
+}
+
+int busUnlock(int bus)
+{
+	BusLockType* l = busLockGet(bus);
+	uint64_t hold;
+
+	if ( (NULL == l) || (gBusLockDepth[bus] == 0))
+	{
+		return ERROR;
+	}
+	if (--gBusLockDepth[bus] > 0)
+	{
+		return OK;
+	}
+	busLockMutex(l);
+	hold = busLockNowNs() - l->holdStartNs;
+	l->stats.holdNs += hold;
+	if (hold > l->stats.holdMaxNs)
+	{
+		l->stats.holdMaxNs = hold;
+	}
+	l->stats.holder = 0;
+	l->serving++;
+	pthread_cond_broadcast(&l->cond);
+	pthread_mutex_unlock(&l->mutex);
+	if ( (bus == BUS_LOCK_SEM_BUS) && gBusLockSemHeld)
+	{
+		gBusLockSemHeld = 0;
+		sem_post(gBusLockSem);
+	}
+	return OK;
+}
+
+int busLockStats(int bus, BusLockStatsType* stats)
+{
+	BusLockType* l = busLockGet(bus);
+
+	if ( (NULL == l) || (NULL == stats))
+	{
+		return ERROR;
+	}
+	busLockMutex(l);
+	busLockRecover(l);
+	*stats = l->stats;
+	stats->queued = l->next - l->serving;
+	pthread_mutex_unlock(&l->mutex);
+	return OK;
+}
+
+const CliCmdType CMD_LOCK_STAT =
+{
+	"-lockstat",
+	1,
+	&doLockStat,
+	"  -lockstat        Display the bus lock contention metrics\n",
+	"  Usage:           "PROGRAM_NAME" -lockstat\n",
+	"  Example:         "PROGRAM_NAME" -lockstat; Display the wait and hold times of every used bus\n"
+};
+
+int doLockStat(int argc, char *argv[])
+{
+	BusLockStatsType st;
+	int bus;
+
+	(void)argv;
+	if (argc != 2)
+	{
+		return ARG_CNT_ERR;
+	}
+	for (bus = 0; bus < I2C_BUS_MAX; bus++)
+	{
+		if ( (OK != busLockStats(bus, &st)) || (st.count == 0))
+		{
+			continue;
+		}
+		outText("Bus %d: %llu locks, %llu contended, %llu recovered, holder %d, %u queued\n",
+			bus, (unsigned long long)st.count, (unsigned long long)st.contended,
+			(unsigned long long)st.recoveries, st.holder, st.queued);
+		outText("  wait avg %llu max %llu us, hold avg %llu max %llu us\n",
+			(unsigned long long)(st.waitNs / st.count / 1000),
+			(unsigned long long)(st.waitMaxNs / 1000),
+			(unsigned long long)(st.holdNs / st.count / 1000),
+			(unsigned long long)(st.holdMaxNs / 1000));
+		// one record per bus
+		outInt("bus", bus);
+		outInt("locks", st.count);
+		outInt("contended", st.contended);
+		outInt("recovered", st.recoveries);
+		outInt("holder", st.holder);
+		outInt("queued", st.queued);
+		outInt("wait_avg_us", st.waitNs / st.count / 1000);
+		outInt("wait_max_us", st.waitMaxNs / 1000);
+		outInt("hold_avg_us", st.holdNs / st.count / 1000);
+		outInt("hold_max_us", st.holdMaxNs / 1000);
+		outRecord(OK);
+	}
+	return OK;
+}
@@ -0,0 +1,30 @@
+#ifndef BUSLOCK_H
+#define BUSLOCK_H
+
+#include <stdint.h>
+#include "cli.h"
+
+#define BUS_LOCK_SHM	"/16inpind.lock"
+
+typedef struct
+{
+	uint64_t count; // acquisitions
+	uint64_t contended; // acquisitions that had to wait
+	uint64_t recoveries; // dead holders or waiters skipped
+	uint64_t waitNs;
+	uint64_t waitMaxNs;
+	uint64_t holdNs;
+	uint64_t holdMaxNs;
+	int32_t holder; // PID, 0 if free
+	uint32_t queued;
+} BusLockStatsType;
+
+extern const CliCmdType CMD_LOCK_STAT;
+
+int busLock(int bus);
+int busUnlock(int bus);
+int busLockStats(int bus, BusLockStatsType* stats);
+
+int doLockStat(int argc, char *argv[]);
+
+#endif /* BUSLOCK_H */
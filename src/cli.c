@@ -1,9 +1,13 @@
 #include "16in.h"
 #include "board.h"
+#include "buslock.h"
 #include "cli.h"
+#include "daemon.h"
 #include "led.h"
 #include "opto.h"
 #include "rs485.h"
+#include "shadow.h"
+#include "snapshot.h"
 #include "wdt.h"
 
 const CliCmdType* gCmdArray[] =
@@ -13,6 +17,11 @@ const CliCmdType* gCmdArray[] =
 	&CMD_WAR,
 	&CMD_LIST,
 	&CMD_BOARD,
+	&CMD_DUMP,
+	&CMD_DAEMON,
+	&CMD_POLLER,
+	&CMD_LOCK_STAT,
+	&CMD_BATCH,
 	&CMD_READ,
 	&CMD_LED_READ,
 	&CMD_LED_WRITE,
@@ -44,6 +53,8 @@ const CliCmdType* gCmdArray[] =
 	&CMD_WDT_CLR_RESET_COUNT,
 	&CMD_OPTO_INT_WR,
 	&CMD_OPTO_INT_RD,
+	&CMD_OPTO_WAIT,
+	&CMD_WATCH,
 
 	0
 }; //null terminated array of cli structure pointers
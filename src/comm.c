@@ -9,14 +9,19 @@
  ***********************************************************************
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include "buslock.h"
 #include "comm.h"
 #include "data.h"
+#include "hist.h"
+#include "shadow.h"
+#include "transport.h"
 
 #define I2C_SLAVE	0x0703
 #define I2C_SMBUS	0x0720	/* SMBus-level access */
@@ -41,7 +46,206 @@
 #define I2C_SMBUS_BLOCK_MAX	32	/* As specified in SMBus standard */
 #define I2C_SMBUS_I2C_BLOCK_MAX	32	/* Not specified but we use same structure */
 
+#define I2C_BUS_DEFAULT	1
+#define I2C_BUS_ENV	"SM16INPIND_BUS"
+#define I2C_TRANSPORT_ENV	"SM16INPIND_TRANSPORT"
+#define I2C_MSG_MAX	42	// I2C_RDWR_IOCTL_MAX_MSGS
+#define I2C_SEG_MAX	(I2C_MSG_MAX / 2)
+
+/*
+ * One file per bus is kept open for the whole process, boards are
+ * handles (bus + slave address) addressed on every transaction.
+ * Handle value is the table index + 1 so it is always > 0.
+ */
+typedef struct
+{
+	int bus;
+	int add;
+	I2cStatsType stats;
+} I2cDevType;
+
+static pthread_mutex_t gI2cLock = PTHREAD_MUTEX_INITIALIZER;
+static const I2cTransportType* gI2cTransportArray[] =
+{
+	&I2C_TRANSPORT_DEV,
+	&I2C_TRANSPORT_LOOP,
+	&I2C_TRANSPORT_SIM,
+	&I2C_TRANSPORT_DAEMON,
+
+	0
+};
+static const I2cTransportType* gI2cTransport = NULL;
+static I2cRetryType gI2cRetry = { RETRY_TIMES, I2C_BACKOFF_US, I2C_BACKOFF_MAX_US };
+static int gI2cAdapterTimeoutMs = I2C_ADAPTER_TIMEOUT_MS;
+static int gI2cAdapterRetries = I2C_ADAPTER_RETRIES;
+static __thread long gI2cDeadlineUs = 0;
+static __thread uint64_t gI2cReqNs = 0;
+static __thread uint64_t gI2cDoneNs = 0;
+static HistType gI2cHist[I2C_CLASS_COUNT];
+static const char* gI2cClassName[I2C_CLASS_COUNT] =
+{
+	"inputs",
+	"config",
+	"counters",
+	"encoder",
+	"pwm",
+	"settings",
+	"frequency",
+	"wdt",
+	"other",
+};
+static int gI2cBusFile[I2C_BUS_MAX] = { [0 ... I2C_BUS_MAX - 1] = -1 };
+static I2cDevType gI2cDev[I2C_DEV_MAX];
+static int gI2cDevCount = 0;
+static int gI2cBusList[I2C_BUS_MAX];
+static int gI2cBusCount = 0;
+
+static const I2cTransportType* i2cTransportFind(const char* name)
+{
+	int i;
+
+	for (i = 0; NULL != gI2cTransportArray[i]; i++)
+	{
+		if (strcasecmp(gI2cTransportArray[i]->name, name) == 0)
+		{
+			return gI2cTransportArray[i];
+		}
+	}
+	return NULL;
+}
+
+// Called with gI2cLock held
+static const I2cTransportType* i2cTransport(void)
+{
+	const char* env = NULL;
+
+	if (NULL == gI2cTransport)
+	{
+		env = getenv(I2C_TRANSPORT_ENV);
+		if ( (env != NULL) && (*env != 0))
+		{
+			gI2cTransport = i2cTransportFind(env);
+		}
+		if (NULL == gI2cTransport)
+		{
+			gI2cTransport = &I2C_TRANSPORT_DEV;
+		}
+	}
+	return gI2cTransport;
+}
+
+static void i2cAdapterApply(int file)
+{
+	if (NULL != i2cTransport()->adapter)
+	{
+		i2cTransport()->adapter(file, gI2cAdapterTimeoutMs, gI2cAdapterRetries);
+	}
+}
+
+static int i2cBusOpen(int bus)
+{
+	if ( (bus < 0) || (bus >= I2C_BUS_MAX))
+	{
+		return -1;
+	}
+	if (gI2cBusFile[bus] >= 0)
+	{
+		return gI2cBusFile[bus];
+	}
+	gI2cBusFile[bus] = i2cTransport()->open(bus);
+	if (gI2cBusFile[bus] < 0)
+	{
+		printf("Failed to open the bus.");
+		return -1;
+	}
+	i2cAdapterApply(gI2cBusFile[bus]);
+	return gI2cBusFile[bus];
+}
+
+static int i2cDevGet(int dev, int* file, int* slave)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&gI2cLock);
+	if ( (dev >= 1) && (dev <= gI2cDevCount))
+	{
+		*file = gI2cBusFile[gI2cDev[dev - 1].bus];
+		*slave = gI2cDev[dev - 1].add;
+		if (*file >= 0)
+		{
+			ret = 0;
+		}
+	}
+	pthread_mutex_unlock(&gI2cLock);
+	return ret;
+}
+
+int i2cDevBus(int dev)
+{
+	int bus = -1;
+
+	pthread_mutex_lock(&gI2cLock);
+	if ( (dev >= 1) && (dev <= gI2cDevCount))
+	{
+		bus = gI2cDev[dev - 1].bus;
+	}
+	pthread_mutex_unlock(&gI2cLock);
+	return bus;
+}
+
+void i2cBusSet(const int* bus, int count)
+{
+	int i;
+	int j;
+
+	pthread_mutex_lock(&gI2cLock);
+	gI2cBusCount = 0;
+	for (i = 0; (i < count) && (i < I2C_BUS_MAX); i++)
+	{
+		for (j = 0; (j < gI2cBusCount) && (gI2cBusList[j] != bus[i]); j++)
+			;
+		if (j == gI2cBusCount)
+		{
+			gI2cBusList[gI2cBusCount++] = bus[i];
+		}
+	}
+	pthread_mutex_unlock(&gI2cLock);
+}
+
+// Selected buses, first one is used by doBoardInit()
+int i2cBusGet(int* bus, int size)
+{
+	int count = 0;
+	const char* env = NULL;
+
+	pthread_mutex_lock(&gI2cLock);
+	if (gI2cBusCount == 0)
+	{
+		env = getenv(I2C_BUS_ENV);
+		gI2cBusList[0] = I2C_BUS_DEFAULT;
+		if ( (env != NULL) && (*env != 0))
+		{
+			gI2cBusList[0] = atoi(env);
+		}
+		gI2cBusCount = 1;
+	}
+	for (count = 0; (count < gI2cBusCount) && (count < size); count++)
+	{
+		bus[count] = gI2cBusList[count];
+	}
+	pthread_mutex_unlock(&gI2cLock);
+	return count;
+}
+
 int doBoardInit(int stack)
+{
+	int bus = I2C_BUS_DEFAULT;
+
+	i2cBusGet(&bus, 1);
+	return doBoardInitBus(bus, stack);
+}
+
+int doBoardInitBus(int bus, int stack)
 {
 	int dev = 0;
 	int add = 0;
@@ -52,7 +256,7 @@ int doBoardInit(int stack)
 		return ERROR;
 	}
 	add = (stack + INPUT16_HW_I2C_BASE_ADD) ^ 0x07;
-	dev = i2cSetup(add);
+	dev = i2cSetupBus(bus, add);
 	if (dev == -1)
 	{
 		return ERROR;
@@ -62,77 +266,896 @@ int doBoardInit(int stack)
 
 int i2cSetup(int addr)
 {
-	int file;
-	char filename[40];
-	sprintf(filename, "/dev/i2c-1");
+	int bus = I2C_BUS_DEFAULT;
+
+	i2cBusGet(&bus, 1);
+	return i2cSetupBus(bus, addr);
+}
+
+int i2cSetupBus(int bus, int addr)
+{
+	int i;
+	int dev = -1;
 
-	if ( (file = open(filename, O_RDWR)) < 0)
+	pthread_mutex_lock(&gI2cLock);
+	if (i2cBusOpen(bus) < 0)
+	{
+		pthread_mutex_unlock(&gI2cLock);
+		return -1;
+	}
+	for (i = 0; i < gI2cDevCount; i++)
+	{
+		if ( (gI2cDev[i].bus == bus) && (gI2cDev[i].add == addr))
+		{
+			dev = i + 1;
+			break;
+		}
+	}
+	if (dev < 0)
+	{
+		if (gI2cDevCount < I2C_DEV_MAX)
+		{
+			memset(&gI2cDev[gI2cDevCount], 0, sizeof(I2cDevType));
+			gI2cDev[gI2cDevCount].bus = bus;
+			gI2cDev[gI2cDevCount].add = addr;
+			gI2cDevCount++;
+			dev = gI2cDevCount;
+		}
+		else
+		{
+			printf("Too many devices open!\n");
+		}
+	}
+	pthread_mutex_unlock(&gI2cLock);
+
+	return dev;
+}
+
+/*
+ * Select the bus backend by name, buses already open are closed and all
+ * board handles are dropped.
+ */
+int i2cTransportSet(const char* name)
+{
+	const I2cTransportType* t = i2cTransportFind(name);
+
+	if (NULL == t)
 	{
-		printf("Failed to open the bus.");
 		return -1;
 	}
-	if (ioctl(file, I2C_SLAVE, addr) < 0)
+	i2cClose();
+	pthread_mutex_lock(&gI2cLock);
+	gI2cTransport = t;
+	pthread_mutex_unlock(&gI2cLock);
+	return 0;
+}
+
+const char* i2cTransportName(void)
+{
+	const char* name;
+
+	pthread_mutex_lock(&gI2cLock);
+	name = i2cTransport()->name;
+	pthread_mutex_unlock(&gI2cLock);
+	return name;
+}
+
+void i2cClose(void)
+{
+	int i;
+
+	pthread_mutex_lock(&gI2cLock);
+	for (i = 0; i < I2C_BUS_MAX; i++)
+	{
+		if (gI2cBusFile[i] >= 0)
+		{
+			i2cTransport()->close(gI2cBusFile[i]);
+			gI2cBusFile[i] = -1;
+		}
+	}
+	for (i = 1; i <= gI2cDevCount; i++)
+	{
+		shadowDisable(i);
+	}
+	gI2cDevCount = 0;
+	pthread_mutex_unlock(&gI2cLock);
+}
+
+typedef struct
+{
+	pthread_t thread;
+	int bus;
+	I2cBusWorkerType fn;
+	void* arg;
+} I2cWorkerType;
+
+static void* i2cWorker(void* arg)
+{
+	I2cWorkerType* w = (I2cWorkerType*)arg;
+
+	w->fn(w->bus, w->arg);
+	return NULL;
+}
+
+/*
+ * Run fn once per bus, each one in its own thread, and wait for all of
+ * them. Transfers on different adapters do not serialize in the kernel
+ * so the throughput scales with the number of buses.
+ */
+int i2cBusWorkersRun(const int* bus, int count, I2cBusWorkerType fn, void* arg)
+{
+	I2cWorkerType w[I2C_BUS_MAX];
+	int i;
+	int started = 0;
+	int ret = 0;
+
+	if ( (NULL == bus) || (NULL == fn) || (count <= 0) || (count > I2C_BUS_MAX))
 	{
-		printf("Failed to acquire bus access and/or talk to slave.\n");
 		return -1;
 	}
+	if (count == 1)
+	{
+		fn(bus[0], arg);
+		return 0;
+	}
+	for (i = 0; i < count; i++)
+	{
+		w[i].bus = bus[i];
+		w[i].fn = fn;
+		w[i].arg = arg;
+		if (pthread_create(&w[i].thread, NULL, i2cWorker, &w[i]) != 0)
+		{
+			ret = -1;
+			break;
+		}
+		started++;
+	}
+	for (i = 0; i < started; i++)
+	{
+		pthread_join(w[i].thread, NULL);
+	}
+	return ret;
+}
+
+// Persistent workers, one per bus, woken for every cycle of the poller
+typedef struct
+{
+	I2cWorkerType w[I2C_BUS_MAX];
+	int count;
+	int threads; // 0: the single bus runs in the caller
+	int stop;
+	int pending;
+	uint64_t cycle;
+	void* arg;
+	pthread_cond_t start;
+	pthread_cond_t done;
+} I2cWorkerPoolType;
+
+static pthread_mutex_t gI2cPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static I2cWorkerPoolType gI2cPool;
+
+static void* i2cPoolWorker(void* arg)
+{
+	I2cWorkerType* w = (I2cWorkerType*)arg;
+	uint64_t cycle = 0;
+	void* cycleArg;
 
-	return file;
+	pthread_mutex_lock(&gI2cPoolLock);
+	while (1)
+	{
+		while ( (!gI2cPool.stop) && (gI2cPool.cycle == cycle))
+		{
+			pthread_cond_wait(&gI2cPool.start, &gI2cPoolLock);
+		}
+		if (gI2cPool.stop)
+		{
+			break;
+		}
+		cycle = gI2cPool.cycle;
+		cycleArg = gI2cPool.arg;
+		pthread_mutex_unlock(&gI2cPoolLock);
+		w->fn(w->bus, cycleArg);
+		pthread_mutex_lock(&gI2cPoolLock);
+		if (--gI2cPool.pending == 0)
+		{
+			pthread_cond_signal(&gI2cPool.done);
+		}
+	}
+	pthread_mutex_unlock(&gI2cPoolLock);
+	return NULL;
 }
 
-int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
+/*
+ * Start one thread per bus running fn on every i2cBusWorkersCycle(), the
+ * threads inherit the scheduling and the affinity of the caller. A single
+ * bus runs in the caller, without thread.
+ */
+int i2cBusWorkersStart(const int* bus, int count, I2cBusWorkerType fn)
 {
-	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
+	int i;
 
-	if (NULL == buff)
+	if ( (NULL == bus) || (NULL == fn) || (count <= 0) || (count > I2C_BUS_MAX)
+		|| (gI2cPool.count > 0))
 	{
 		return -1;
 	}
+	memset(&gI2cPool, 0, sizeof(gI2cPool));
+	pthread_cond_init(&gI2cPool.start, NULL);
+	pthread_cond_init(&gI2cPool.done, NULL);
+	for (i = 0; i < count; i++)
+	{
+		gI2cPool.w[i].bus = bus[i];
+		gI2cPool.w[i].fn = fn;
+	}
+	gI2cPool.count = count;
+	if (count == 1)
+	{
+		return 0;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (pthread_create(&gI2cPool.w[i].thread, NULL, i2cPoolWorker,
+			&gI2cPool.w[i]) != 0)
+		{
+			i2cBusWorkersStop();
+			return -1;
+		}
+		gI2cPool.threads++;
+	}
+	return 0;
+}
 
-	if (size > I2C_SMBUS_BLOCK_MAX)
+// Run one cycle on every bus and wait for all of them
+int i2cBusWorkersCycle(void* arg)
+{
+	if (gI2cPool.count <= 0)
 	{
 		return -1;
 	}
+	if (gI2cPool.threads == 0)
+	{
+		gI2cPool.w[0].fn(gI2cPool.w[0].bus, arg);
+		return 0;
+	}
+	pthread_mutex_lock(&gI2cPoolLock);
+	gI2cPool.arg = arg;
+	gI2cPool.pending = gI2cPool.threads;
+	gI2cPool.cycle++;
+	pthread_cond_broadcast(&gI2cPool.start);
+	while (gI2cPool.pending > 0)
+	{
+		pthread_cond_wait(&gI2cPool.done, &gI2cPoolLock);
+	}
+	pthread_mutex_unlock(&gI2cPoolLock);
+	return 0;
+}
+
+void i2cBusWorkersStop(void)
+{
+	int i;
+
+	if (gI2cPool.count <= 0)
+	{
+		return;
+	}
+	pthread_mutex_lock(&gI2cPoolLock);
+	gI2cPool.stop = 1;
+	pthread_cond_broadcast(&gI2cPool.start);
+	pthread_mutex_unlock(&gI2cPoolLock);
+	for (i = 0; i < gI2cPool.threads; i++)
+	{
+		pthread_join(gI2cPool.w[i].thread, NULL);
+	}
+	pthread_cond_destroy(&gI2cPool.start);
+	pthread_cond_destroy(&gI2cPool.done);
+	gI2cPool.count = 0;
+}
+
+void i2cRetrySet(const I2cRetryType* retry)
+{
+	if (NULL != retry)
+	{
+		gI2cRetry = *retry;
+	}
+}
+
+void i2cRetryGet(I2cRetryType* retry)
+{
+	if (NULL != retry)
+	{
+		*retry = gI2cRetry;
+	}
+}
+
+int i2cStatsGet(int dev, I2cStatsType* stats)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&gI2cLock);
+	if ( (NULL != stats) && (dev >= 1) && (dev <= gI2cDevCount))
+	{
+		*stats = gI2cDev[dev - 1].stats;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&gI2cLock);
+	return ret;
+}
 
-	intBuff[0] = 0xff & add;
+static I2cStatsType* i2cStats(int dev)
+{
+	static I2cStatsType dummy;
 
-	if (write(dev, intBuff, 1) != 1)
+	if ( (dev < 1) || (dev > I2C_DEV_MAX))
+	{
+		return &dummy;
+	}
+	return &gI2cDev[dev - 1].stats;
+}
+
+#define I2C_STAT_INC(x)	__atomic_add_fetch(&(x), 1, __ATOMIC_RELAXED)
+
+// Probes of a stack level: a NACK there means no card, it is not retried
+static __thread int gI2cProbe = 0;
+
+int i2cProbeSet(int probe)
+{
+	int prev = gI2cProbe;
+
+	gI2cProbe = probe;
+	return prev;
+}
+
+/*
+ * Only bus level errors are worth a retry: no ack from the slave
+ * (EREMOTEIO, except in a probe), clock stretching / adapter timeout
+ * (ETIMEDOUT) and lost arbitration against another master (EAGAIN).
+ */
+static int i2cErrTransient(int err, I2cStatsType* stats)
+{
+	switch (err)
+	{
+	case EREMOTEIO:
+		I2C_STAT_INC(stats->errNack);
+		return 1;
+	case ETIMEDOUT:
+		I2C_STAT_INC(stats->errTimeout);
+		return 1;
+	case EAGAIN:
+		I2C_STAT_INC(stats->errArbitration);
+		return 1;
+	default:
+		I2C_STAT_INC(stats->errOther);
+		return 0;
+	}
+}
+
+// Exponential backoff with +-50% jitter so contending masters spread out
+static long i2cBackoffUs(int attempt)
+{
+	static __thread unsigned int seed = 0;
+	long us = gI2cRetry.backoffUs;
+
+	if (seed == 0)
+	{
+		seed = (unsigned int)getpid() ^ (unsigned int)time(NULL)
+			^ (unsigned int)(uintptr_t)&us;
+	}
+	while ( (attempt-- > 0) && (us < gI2cRetry.backoffMaxUs))
+	{
+		us *= 2;
+	}
+	if (us > gI2cRetry.backoffMaxUs)
+	{
+		us = gI2cRetry.backoffMaxUs;
+	}
+	if (us <= 0)
+	{
+		return 0;
+	}
+	return us / 2 + rand_r(&seed) % (us + 1);
+}
+
+static void i2cSleepUs(long us)
+{
+	struct timespec ts;
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	while ( (nanosleep(&ts, &ts) == -1) && (errno == EINTR))
+		;
+}
+
+static uint64_t i2cNowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t i2cRawNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * CLOCK_MONOTONIC_RAW request and completion time of the last successful
+ * transfer of the calling thread: the sampling time of what it read.
+ */
+void i2cSampleTime(uint64_t* reqNs, uint64_t* doneNs)
+{
+	if (NULL != reqNs)
+	{
+		*reqNs = gI2cReqNs;
+	}
+	if (NULL != doneNs)
+	{
+		*doneNs = gI2cDoneNs;
+	}
+}
+
+int i2cRegClass(int add)
+{
+	if (add < I2C_MEM_LED_VAL)
+	{
+		return I2C_CLASS_INPUTS;
+	}
+	if (add < I2C_MEM_OPTO_EDGE_COUNT_ADD)
+	{
+		return I2C_CLASS_CONFIG;
+	}
+	if (add < I2C_MEM_OPTO_ENC_COUNT_ADD)
+	{
+		return I2C_CLASS_COUNTERS;
+	}
+	if (add < I2C_MEM_PWM_IN_FILL)
+	{
+		return I2C_CLASS_ENCODER;
+	}
+	if (add < I2C_MODBUS_SETINGS_ADD)
+	{
+		return I2C_CLASS_PWM;
+	}
+	if (add <= I2C_MEM_PWR_LED_MODE)
+	{
+		return I2C_CLASS_SETTINGS;
+	}
+	if ( (add >= I2C_MEM_IN_FREQENCY) && (add < I2C_MEM_WDT_RESET_ADD))
+	{
+		return I2C_CLASS_FREQUENCY;
+	}
+	if ( (add >= I2C_MEM_WDT_RESET_ADD) && (add < I2C_MEM_EXTI_EN_ADD))
+	{
+		return I2C_CLASS_WDT;
+	}
+	if ( (add >= I2C_MEM_EXTI_EN_ADD) && (add < I2C_MEM_EXTI_EN_ADD + 2))
+	{
+		return I2C_CLASS_CONFIG;
+	}
+	return I2C_CLASS_OTHER;
+}
+
+// retries < 0 leaves the adapter retry count as it is
+void i2cAdapterSet(int timeoutMs, int retries)
+{
+	int i;
+
+	pthread_mutex_lock(&gI2cLock);
+	gI2cAdapterTimeoutMs = timeoutMs;
+	gI2cAdapterRetries = retries;
+	for (i = 0; i < I2C_BUS_MAX; i++)
+	{
+		if (gI2cBusFile[i] >= 0)
+		{
+			i2cAdapterApply(gI2cBusFile[i]);
+		}
+	}
+	pthread_mutex_unlock(&gI2cLock);
+}
+
+// Upper bound for every following transaction of the calling thread,
+// retries included; 0 means no deadline
+void i2cDeadlineSet(long us)
+{
+	gI2cDeadlineUs = us;
+}
+
+int i2cHistGet(int cls, HistType* h)
+{
+	if ( (cls < 0) || (cls >= I2C_CLASS_COUNT) || (NULL == h))
 	{
-		//printf("Fail to select mem add!\n");
 		return -1;
 	}
-	if (read(dev, buff, size) != size)
+	*h = gI2cHist[cls];
+	return 0;
+}
+
+void i2cHistReset(void)
+{
+	int i;
+
+	for (i = 0; i < I2C_CLASS_COUNT; i++)
+	{
+		histReset(&gI2cHist[i]);
+	}
+}
+
+void i2cStatsPrint(FILE* f)
+{
+	I2cStatsType st;
+	int i;
+
+	for (i = 1; i2cStatsGet(i, &st) == 0; i++)
+	{
+		fprintf(f, "bus %d add 0x%02x: transfers=%u retries=%u failures=%u"
+			" nack=%u timeout=%u arbitration=%u other=%u deadline=%u\n",
+			gI2cDev[i - 1].bus, gI2cDev[i - 1].add, st.transfers, st.retries,
+			st.failures, st.errNack, st.errTimeout, st.errArbitration,
+			st.errOther, st.deadlineMiss);
+	}
+	fprintf(f, "latency (ns) per register class:\n");
+	for (i = 0; i < I2C_CLASS_COUNT; i++)
+	{
+		histPrint(f, gI2cClassName[i], &gI2cHist[i]);
+	}
+}
+
+/*
+ * Transactions of other processes are kept out of the bus from
+ * i2cGroupBegin() to i2cGroupEnd(), calls nest. Every transfer is a
+ * group on its own, a caller groups several transactions explicitly.
+ */
+static int i2cTransportShared(void)
+{
+	int shared;
+
+	pthread_mutex_lock(&gI2cLock);
+	shared = i2cTransport()->shared;
+	pthread_mutex_unlock(&gI2cLock);
+	return shared;
+}
+
+int i2cGroupBegin(int bus)
+{
+	return i2cTransportShared() ? busLock(bus) : OK;
+}
+
+int i2cGroupEnd(int bus)
+{
+	return i2cTransportShared() ? busUnlock(bus) : OK;
+}
+
+static int i2cTransfer(int dev, int add, int file, struct i2c_msg* msgs,
+	int count)
+{
+	I2cStatsType* stats = i2cStats(dev);
+	uint64_t start = i2cNowNs();
+	uint64_t elapsed = 0;
+	uint64_t req = 0;
+	uint64_t done = 0;
+	long backoff = 0;
+	long left = 0;
+	int attempt = 0;
+	int bus = i2cDevBus(dev);
+	int err = 0;
+	int ret = 0;
+
+	while (1)
+	{
+		// no attempt is started once the deadline is spent
+		if ( (gI2cDeadlineUs > 0) && (attempt > 0)
+			&& ( (i2cNowNs() - start) / 1000 >= (uint64_t)gI2cDeadlineUs))
+		{
+			I2C_STAT_INC(stats->deadlineMiss);
+			break;
+		}
+		// the bus is held for the transfer only, not across the backoff
+		if (i2cGroupBegin(bus) != OK)
+		{
+			// never talk to the cards without the exclusion of the others
+			err = ENOLCK;
+			break;
+		}
+		I2C_STAT_INC(stats->transfers);
+		req = i2cRawNs();
+		ret = gI2cTransport->transfer(file, msgs, count);
+		// the unlock may change errno
+		err = ret < 0 ? errno : EIO;
+		done = i2cRawNs();
+		i2cGroupEnd(bus);
+		elapsed = i2cNowNs() - start;
+		if (ret == count)
+		{
+			gI2cReqNs = req;
+			gI2cDoneNs = done;
+			histRecord(&gI2cHist[i2cRegClass(add)], elapsed);
+			return 0;
+		}
+		if ( (!i2cErrTransient(err, stats)) || (gI2cProbe && (err == EREMOTEIO))
+			|| (attempt >= gI2cRetry.retries))
+		{
+			break;
+		}
+		backoff = i2cBackoffUs(attempt);
+		if (gI2cDeadlineUs > 0)
+		{
+			left = gI2cDeadlineUs - (long)(elapsed / 1000);
+			if (left <= 0)
+			{
+				I2C_STAT_INC(stats->deadlineMiss);
+				break;
+			}
+			if (backoff > left)
+			{
+				backoff = left;
+			}
+		}
+		I2C_STAT_INC(stats->retries);
+		i2cSleepUs(backoff);
+		attempt++;
+	}
+	I2C_STAT_INC(stats->failures);
+	errno = err;
+	return -1;
+}
+
+/*
+ * Register windows are split in chunks of at most I2C_SMBUS_BLOCK_MAX
+ * bytes, each chunk is an address write + read message pair and all
+ * the chunks of a submission go in one I2C_RDWR transfer.
+ */
+typedef struct
+{
+	int slave;
+	int add;
+	uint8_t* buff;
+	int size;
+} I2cChunkType;
+
+#define I2C_CHUNKS(size)	(((size) + I2C_SMBUS_BLOCK_MAX - 1) / I2C_SMBUS_BLOCK_MAX)
+#define I2C_CHUNK_MAX	I2C_CHUNKS(I2C_MEM_SIZE)
+
+static int i2cRangeBad(int add, uint8_t* buff, int size)
+{
+	return (NULL == buff) || (add < 0) || (size <= 0)
+		|| (add + size > I2C_MEM_SIZE);
+}
+
+static int i2cChunksMake(int slave, int add, uint8_t* buff, int size,
+	int chunkSize, I2cChunkType* chunk)
+{
+	int count = 0;
+	int len = 0;
+
+	while (size > 0)
+	{
+		len = size > chunkSize ? chunkSize : size;
+		chunk[count].slave = slave;
+		chunk[count].add = add;
+		chunk[count].buff = buff;
+		chunk[count].size = len;
+		count++;
+		add += len;
+		buff += len;
+		size -= len;
+	}
+	return count;
+}
+
+static int i2cRdwrRead(int dev, int file, const I2cChunkType* chunk, int count)
+{
+	uint8_t addBuff[I2C_SEG_MAX];
+	struct i2c_msg msgs[2 * I2C_SEG_MAX];
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		addBuff[i] = 0xff & chunk[i].add;
+		msgs[2 * i].addr = chunk[i].slave;
+		msgs[2 * i].flags = 0;
+		msgs[2 * i].len = 1;
+		msgs[2 * i].buf = &addBuff[i];
+		msgs[2 * i + 1].addr = chunk[i].slave;
+		msgs[2 * i + 1].flags = I2C_M_RD;
+		msgs[2 * i + 1].len = chunk[i].size;
+		msgs[2 * i + 1].buf = chunk[i].buff;
+	}
+	if (i2cTransfer(dev, chunk[0].add, file, msgs, 2 * count) != 0)
 	{
 		//printf("Fail to read memory!\n");
 		return -1;
 	}
-	return 0; //OK
+	return 0;
 }
 
-int i2cMem8Write(int dev, int add, uint8_t* buff, int size)
+int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
 {
-	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
+	I2cChunkType chunk[I2C_CHUNK_MAX];
+	int count = 0;
+	int file = 0;
+	int slave = 0;
 
-	if (NULL == buff)
+	if (i2cRangeBad(add, buff, size))
 	{
 		return -1;
 	}
+	if (OK == shadowRead(dev, add, buff, size))
+	{
+		return 0;
+	}
+	if (i2cDevGet(dev, &file, &slave) < 0)
+	{
+		return -1;
+	}
+	// register address write and data read in one transfer (repeated start)
+	count = i2cChunksMake(slave, add, buff, size, I2C_SMBUS_BLOCK_MAX, chunk);
+	return i2cRdwrRead(dev, file, chunk, count);
+}
+
+static void i2cSegTime(I2cReadSegType* seg, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (seg[i].status == 0)
+		{
+			i2cSampleTime(&seg[i].reqNs, &seg[i].doneNs);
+		}
+	}
+}
 
-	if (size > I2C_SMBUS_BLOCK_MAX - 1)
+int i2cMem8ReadMulti(int dev, I2cReadSegType* seg, int count)
+{
+	int i;
+
+	if ( (NULL == seg) || (count <= 0))
 	{
 		return -1;
 	}
+	for (i = 0; i < count; i++)
+	{
+		seg[i].dev = dev;
+	}
+	return i2cMem8ReadFrame(seg, count);
+}
 
-	intBuff[0] = 0xff & add;
-	memcpy(&intBuff[1], buff, size);
+/*
+ * Segments of several boards (seg.dev) of the same bus: the chunks of all
+ * the slaves share the submissions, one transfer reads a whole stack of
+ * cards when it fits in the kernel message limit.
+ */
+int i2cMem8ReadFrame(I2cReadSegType* seg, int count)
+{
+	I2cChunkType chunk[I2C_SEG_MAX];
+	int file = -1;
+	int segFile = 0;
+	int slave = 0;
+	int dev = 0;
+	int ret = 0;
+	int first = 0;
+	int last = 0;
+	int n = 0;
+	int i = 0;
 
-	if (write(dev, intBuff, size + 1) != size + 1)
+	if ( (NULL == seg) || (count <= 0))
 	{
-		//printf("Fail to write memory!\n");
 		return -1;
 	}
-	return 0;
+	for (i = 0; i < count; i++)
+	{
+		seg[i].status = -1;
+		if (i2cRangeBad(seg[i].add, seg[i].buff, seg[i].size)
+			|| (i2cDevGet(seg[i].dev, &segFile, &slave) < 0))
+		{
+			ret = -1;
+			continue;
+		}
+		if (file < 0)
+		{
+			file = segFile;
+		}
+		if (segFile != file)
+		{
+			ret = -1; // not on the bus of the first segment
+			continue;
+		}
+		seg[i].status = 0;
+	}
+	// pack whole segments in submissions up to the kernel message limit
+	for (first = 0; first < count; first = last)
+	{
+		n = 0;
+		for (last = first; last < count; last++)
+		{
+			if (seg[last].status != 0)
+			{
+				continue;
+			}
+			if (n + I2C_CHUNKS(seg[last].size) > I2C_SEG_MAX)
+			{
+				break;
+			}
+			if (n == 0)
+			{
+				dev = seg[last].dev;
+			}
+			i2cDevGet(seg[last].dev, &segFile, &slave);
+			n += i2cChunksMake(slave, seg[last].add, seg[last].buff,
+				seg[last].size, I2C_SMBUS_BLOCK_MAX, &chunk[n]);
+		}
+		if (n == 0)
+		{
+			continue;
+		}
+		if (i2cRdwrRead(dev, file, chunk, n) == 0)
+		{
+			i2cSegTime(&seg[first], last - first);
+			continue;
+		}
+		// the kernel does not report which message failed, isolate it
+		for (i = first; i < last; i++)
+		{
+			if (seg[i].status != 0)
+			{
+				continue;
+			}
+			i2cDevGet(seg[i].dev, &segFile, &slave);
+			n = i2cChunksMake(slave, seg[i].add, seg[i].buff, seg[i].size,
+				I2C_SMBUS_BLOCK_MAX, chunk);
+			seg[i].status = i2cRdwrRead(seg[i].dev, file, chunk, n);
+			if (seg[i].status != 0)
+			{
+				ret = -1;
+			}
+			else
+			{
+				i2cSegTime(&seg[i], 1);
+			}
+		}
+	}
+	return ret;
 }
 
+int i2cMem8Write(int dev, int add, uint8_t* buff, int size)
+{
+	uint8_t intBuff[I2C_CHUNK_MAX + 1][I2C_SMBUS_BLOCK_MAX];
+	I2cChunkType chunk[I2C_CHUNK_MAX + 1];
+	struct i2c_msg msgs[I2C_CHUNK_MAX + 1];
+	int count = 0;
+	int file = 0;
+	int slave = 0;
+	int i = 0;
 
+	if (i2cRangeBad(add, buff, size))
+	{
+		return -1;
+	}
+	if (i2cDevGet(dev, &file, &slave) < 0)
+	{
+		return -1;
+	}
 
+	// one message per chunk, each starting with its register address
+	count = i2cChunksMake(slave, add, buff, size, I2C_SMBUS_BLOCK_MAX - 1, chunk);
+	for (i = 0; i < count; i++)
+	{
+		intBuff[i][0] = 0xff & chunk[i].add;
+		memcpy(&intBuff[i][1], chunk[i].buff, chunk[i].size);
+		msgs[i].addr = slave;
+		msgs[i].flags = 0;
+		msgs[i].len = chunk[i].size + 1;
+		msgs[i].buf = intBuff[i];
+	}
+
+	shadowInvalidate(dev);
+	if (i2cTransfer(dev, add, file, msgs, count) != 0)
+	{
+		//printf("Fail to write memory!\n");
+		return -1;
+	}
+	return 0;
+}
@@ -2,11 +2,101 @@
 #define COMM_H_
 
 #include <stdint.h>
+#include <stdio.h>
+#include "hist.h"
+
+// One register window of a vectored read, status is set per segment.
+// Windows may be of any size inside the 8 bit address space.
+typedef struct
+{
+	int add;
+	uint8_t* buff;
+	int size;
+	int status;
+	int dev; // board handle, i2cMem8ReadFrame() only
+	uint64_t reqNs; // CLOCK_MONOTONIC_RAW request and completion of the read
+	uint64_t doneNs;
+} I2cReadSegType;
+
+#define I2C_BUS_MAX	16
+#define I2C_DEV_MAX	64
+#define I2C_MEM_SIZE	256	// 8 bit register address space
+
+#define RETRY_TIMES	10
+#define I2C_BACKOFF_US	100
+#define I2C_BACKOFF_MAX_US	5000
+#define I2C_ADAPTER_TIMEOUT_MS	100
+#define I2C_ADAPTER_RETRIES	-1 // -1 keeps the adapter setting
+
+// Register groups with their own latency histogram
+enum
+{
+	I2C_CLASS_INPUTS,
+	I2C_CLASS_CONFIG,
+	I2C_CLASS_COUNTERS,
+	I2C_CLASS_ENCODER,
+	I2C_CLASS_PWM,
+	I2C_CLASS_SETTINGS,
+	I2C_CLASS_FREQUENCY,
+	I2C_CLASS_WDT,
+	I2C_CLASS_OTHER,
+	I2C_CLASS_COUNT,
+};
+
+// Retries of a failed transfer on transient bus errors
+typedef struct
+{
+	int retries;
+	int backoffUs; // first backoff, doubled on every retry
+	int backoffMaxUs;
+} I2cRetryType;
+
+// Per board transfer counters
+typedef struct
+{
+	uint32_t transfers;
+	uint32_t retries;
+	uint32_t failures;
+	uint32_t errNack;
+	uint32_t errTimeout;
+	uint32_t errArbitration;
+	uint32_t errOther;
+	uint32_t deadlineMiss;
+} I2cStatsType;
+
+typedef void (*I2cBusWorkerType)(int bus, void* arg);
 
 int doBoardInit(int stack);
+int doBoardInitBus(int bus, int stack);
 
 int i2cSetup(int addr);
+int i2cSetupBus(int bus, int addr);
+void i2cClose(void);
+int i2cTransportSet(const char* name);
+const char* i2cTransportName(void);
+void i2cBusSet(const int* bus, int count);
+int i2cBusGet(int* bus, int size);
+int i2cProbeSet(int probe);
+int i2cBusWorkersRun(const int* bus, int count, I2cBusWorkerType fn, void* arg);
+int i2cBusWorkersStart(const int* bus, int count, I2cBusWorkerType fn);
+int i2cBusWorkersCycle(void* arg);
+void i2cBusWorkersStop(void);
+int i2cDevBus(int dev);
+int i2cGroupBegin(int bus);
+int i2cGroupEnd(int bus);
+void i2cRetrySet(const I2cRetryType* retry);
+void i2cRetryGet(I2cRetryType* retry);
+int i2cStatsGet(int dev, I2cStatsType* stats);
+void i2cStatsPrint(FILE* f);
+void i2cAdapterSet(int timeoutMs, int retries);
+void i2cDeadlineSet(long us);
+void i2cSampleTime(uint64_t* reqNs, uint64_t* doneNs);
+int i2cRegClass(int add);
+int i2cHistGet(int cls, HistType* h);
+void i2cHistReset(void);
 int i2cMem8Read(int dev, int add, uint8_t* buff, int size);
+int i2cMem8ReadMulti(int dev, I2cReadSegType* seg, int count);
+int i2cMem8ReadFrame(I2cReadSegType* seg, int count);
 int i2cMem8Write(int dev, int add, uint8_t* buff, int size);
 
 
@@ -0,0 +1,542 @@
+/*
+ * daemon.c:
+ *	Resident bus server: keeps the buses open and answers register
+ *	reads and writes from local clients (CLI "daemon" transport, Python,
+ *	Node-RED) over a unix socket, see daemon.h for the protocol.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "comm.h"
+#include "daemon.h"
+#include "data.h"
+#include "transport.h"
+
+#define DAEMON_CLIENT_MAX	32
+#define DAEMON_IN_SIZE	4096
+#define DAEMON_OUT_SIZE	(64 * 1024)
+#define DAEMON_RESP_MAX	(sizeof(DaemonRespType) + 255)
+
+typedef struct
+{
+	int fd;
+	uint8_t in[DAEMON_IN_SIZE];
+	int inLen;
+	uint8_t out[DAEMON_OUT_SIZE];
+	int outLen;
+	int outPos;
+} DaemonClientType;
+
+static volatile sig_atomic_t gDaemonStop = 0;
+
+static void daemonSignal(int sig)
+{
+	(void)sig;
+	gDaemonStop = 1;
+}
+
+static const char* daemonSocketPath(int argc, char *argv[], int pos)
+{
+	const char* env = getenv(DAEMON_SOCKET_ENV);
+
+	if (argc > pos)
+	{
+		return argv[pos];
+	}
+	if ( (env != NULL) && (*env != 0))
+	{
+		return env;
+	}
+	return DAEMON_SOCKET;
+}
+
+/*
+ * The binary may be installed setuid root: the socket path comes from the
+ * caller, it is created and removed with the real ids of the caller. The
+ * bus access keeps the effective ids.
+ */
+static uid_t gDaemonEuid;
+static gid_t gDaemonEgid;
+
+static int daemonCallerIds(int caller)
+{
+	if (caller)
+	{
+		gDaemonEuid = geteuid();
+		gDaemonEgid = getegid();
+		if ( (setegid(getgid()) != 0) || (seteuid(getuid()) != 0))
+		{
+			printf("Fail to drop the privileges\n");
+			return -1;
+		}
+		return 0;
+	}
+	if ( (seteuid(gDaemonEuid) != 0) || (setegid(gDaemonEgid) != 0))
+	{
+		printf("Fail to restore the privileges\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void daemonUnlink(const char* path)
+{
+	if (daemonCallerIds(1) == 0)
+	{
+		unlink(path);
+	}
+	daemonCallerIds(0);
+}
+
+static int daemonListen(const char* path)
+{
+	struct sockaddr_un sa;
+	int fd;
+
+	if (strlen(path) >= sizeof(sa.sun_path))
+	{
+		printf("Socket path too long\n");
+		return -1;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		printf("Fail to create the socket\n");
+		return -1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+	if (daemonCallerIds(1) != 0)
+	{
+		daemonCallerIds(0);
+		close(fd);
+		return -1;
+	}
+	unlink(path);
+	if ( (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0)
+		|| (listen(fd, DAEMON_CLIENT_MAX) < 0)
+		|| (chmod(path, 0666) < 0))
+	{
+		printf("Fail to listen on %s\n", path);
+		close(fd);
+		fd = -1;
+	}
+	if (daemonCallerIds(0) != 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+// Only the card addresses of the buses the daemon was started for
+static int daemonAllowed(const DaemonReqType* req)
+{
+	int bus[I2C_BUS_MAX];
+	int count = i2cBusGet(bus, I2C_BUS_MAX);
+	int i;
+
+	if ( (req->slave < INPUT16_HW_I2C_BASE_ADD)
+		|| (req->slave > INPUT16_HW_I2C_BASE_ADD + 7))
+	{
+		return 0;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (bus[i] == req->bus)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Execute one request, the response is appended to the output buffer
+static void daemonRequest(DaemonClientType* c, const DaemonReqType* req,
+	const uint8_t* data)
+{
+	DaemonRespType* resp = (DaemonRespType*)&c->out[c->outLen];
+	uint8_t* payload = &c->out[c->outLen + sizeof(DaemonRespType)];
+	int dev;
+
+	resp->op = req->op;
+	resp->status = 0;
+	resp->len = 0;
+	resp->reserved = 0;
+	resp->tag = req->tag;
+	switch (req->op)
+	{
+	case DAEMON_OP_PING:
+		break;
+	case DAEMON_OP_READ:
+	case DAEMON_OP_WRITE:
+		if (!daemonAllowed(req))
+		{
+			resp->status = EACCES;
+			break;
+		}
+		dev = i2cSetupBus(req->bus, req->slave);
+		if (dev <= 0)
+		{
+			resp->status = ENODEV;
+			break;
+		}
+		if (req->op == DAEMON_OP_READ)
+		{
+			if (OK != i2cMem8Read(dev, req->add, payload, req->len))
+			{
+				resp->status = EIO;
+				break;
+			}
+			resp->len = req->len;
+		}
+		else if (OK != i2cMem8Write(dev, req->add, (uint8_t*)data, req->len))
+		{
+			resp->status = EIO;
+		}
+		break;
+	default:
+		resp->status = EINVAL;
+		break;
+	}
+	c->outLen += sizeof(DaemonRespType) + resp->len;
+}
+
+// Serve every complete request in the input buffer while there is room
+// for the worst case response
+static void daemonParse(DaemonClientType* c)
+{
+	DaemonReqType req;
+	int pos = 0;
+	int size;
+
+	while (c->inLen - pos >= (int)sizeof(DaemonReqType))
+	{
+		memcpy(&req, &c->in[pos], sizeof(req));
+		size = sizeof(req) + (req.op == DAEMON_OP_WRITE ? req.len : 0);
+		if ( (c->inLen - pos < size)
+			|| (c->outLen + (int)DAEMON_RESP_MAX > DAEMON_OUT_SIZE))
+		{
+			break;
+		}
+		daemonRequest(c, &req, &c->in[pos + sizeof(req)]);
+		pos += size;
+	}
+	memmove(c->in, &c->in[pos], c->inLen - pos);
+	c->inLen -= pos;
+}
+
+static int daemonFlush(DaemonClientType* c)
+{
+	ssize_t n;
+
+	while (c->outPos < c->outLen)
+	{
+		n = send(c->fd, &c->out[c->outPos], c->outLen - c->outPos,
+			MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			return ( (errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+		}
+		c->outPos += n;
+	}
+	c->outPos = c->outLen = 0;
+	return 0;
+}
+
+// Returns -1 when the client is gone
+static int daemonClientIo(DaemonClientType* c, short revents)
+{
+	ssize_t n;
+
+	if (revents & (POLLERR | POLLNVAL))
+	{
+		return -1;
+	}
+	if (revents & (POLLIN | POLLHUP))
+	{
+		n = recv(c->fd, &c->in[c->inLen], DAEMON_IN_SIZE - c->inLen,
+			MSG_DONTWAIT);
+		if (n == 0)
+		{
+			return -1;
+		}
+		if (n > 0)
+		{
+			c->inLen += n;
+		}
+		else if ( (errno != EAGAIN) && (errno != EINTR))
+		{
+			return -1;
+		}
+	}
+	daemonParse(c);
+	return daemonFlush(c);
+}
+
+int daemonRun(const char* path)
+{
+	static DaemonClientType client[DAEMON_CLIENT_MAX];
+	struct pollfd pfd[DAEMON_CLIENT_MAX + 1];
+	int count = 0;
+	int lfd;
+	int fd;
+	int i;
+
+	lfd = daemonListen(path);
+	if (lfd < 0)
+	{
+		return ERROR;
+	}
+	signal(SIGINT, daemonSignal);
+	signal(SIGTERM, daemonSignal);
+	signal(SIGPIPE, SIG_IGN);
+	while (!gDaemonStop)
+	{
+		pfd[0].fd = lfd;
+		pfd[0].events = count < DAEMON_CLIENT_MAX ? POLLIN : 0;
+		for (i = 0; i < count; i++)
+		{
+			pfd[i + 1].fd = client[i].fd;
+			// no more input while the previous responses are not sent
+			pfd[i + 1].events = client[i].outLen > 0 ? POLLOUT : POLLIN;
+		}
+		if (poll(pfd, count + 1, -1) < 0)
+		{
+			continue; // EINTR, the stop flag is checked
+		}
+		for (i = count - 1; i >= 0; i--)
+		{
+			if ( (pfd[i + 1].revents != 0)
+				&& (daemonClientIo(&client[i], pfd[i + 1].revents) != 0))
+			{
+				close(client[i].fd);
+				client[i] = client[--count];
+			}
+		}
+		if (pfd[0].revents & POLLIN)
+		{
+			fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (fd >= 0)
+			{
+				client[count].fd = fd;
+				client[count].inLen = 0;
+				client[count].outLen = 0;
+				client[count].outPos = 0;
+				count++;
+			}
+		}
+	}
+	for (i = 0; i < count; i++)
+	{
+		close(client[i].fd);
+	}
+	close(lfd);
+	daemonUnlink(path);
+	i2cClose();
+	return OK;
+}
+
+const CliCmdType CMD_DAEMON =
+{
+	"-daemon",
+	1,
+	&doDaemon,
+	"  -daemon          Run as resident bus server for local clients, also started as "DAEMON_NAME"\n",
+	"  Usage:           "PROGRAM_NAME" -daemon [<socket path>]\n",
+	"  Example:         "PROGRAM_NAME" -daemon /run/"PROGRAM_NAME".sock; Serve the boards on the socket\n"
+};
+// true when started through the 16inpindd link
+int daemonInvoked(const char* arg0)
+{
+	const char* name = strrchr(arg0, '/');
+
+	return strcmp(name != NULL ? name + 1 : arg0, DAEMON_NAME) == 0;
+}
+
+int doDaemon(int argc, char *argv[])
+{
+	int pos = 2;
+
+	if (strcmp(i2cTransportName(), I2C_TRANSPORT_DAEMON.name) == 0)
+	{
+		printf("The daemon can not use the daemon transport\n");
+		return ERROR;
+	}
+	// started through the link the socket is the first argument
+	if (daemonInvoked(argv[0]))
+	{
+		pos = 1;
+	}
+	return daemonRun(daemonSocketPath(argc, argv, pos));
+}
+
+/*
+ * Client side transport: every message pair of a transfer becomes one
+ * request, the whole transfer is sent at once and the responses are
+ * collected afterwards (pipelined).
+ */
+#define DAEMON_FD_MAX	1024
+
+static uint8_t gDaemonBus[DAEMON_FD_MAX];
+static uint16_t gDaemonTag[DAEMON_FD_MAX]; // runs on from one transfer to the next
+
+static int daemonOpen(int bus)
+{
+	struct sockaddr_un sa;
+	const char* path = daemonSocketPath(0, NULL, 1);
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, path, sizeof(sa.sun_path) - 1);
+	if ( (fd >= DAEMON_FD_MAX)
+		|| (connect(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0))
+	{
+		close(fd);
+		return -1;
+	}
+	gDaemonBus[fd] = (uint8_t)bus;
+	gDaemonTag[fd] = 0;
+	return fd;
+}
+
+static int daemonIo(int fd, void* buf, size_t size, int rd)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < size)
+	{
+		n = rd ? recv(fd, (uint8_t*)buf + done, size - done, 0)
+			: send(fd, (uint8_t*)buf + done, size - done, MSG_NOSIGNAL);
+		if (n <= 0)
+		{
+			if ( (n < 0) && (errno == EINTR))
+			{
+				continue;
+			}
+			errno = EIO;
+			return -1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+static int daemonTransfer(int fd, struct i2c_msg* msgs, int count)
+{
+	uint8_t buf[42 * (sizeof(DaemonReqType) + 255)];
+	DaemonReqType req;
+	DaemonRespType resp;
+	int reqMsg[42];
+	uint16_t tag = gDaemonTag[fd];
+	int status = 0;
+	int len = 0;
+	int n = 0;
+	int i;
+
+	for (i = 0; (i < count) && (n < 42); i++)
+	{
+		if ( (msgs[i].flags & I2C_M_RD) || (msgs[i].len < 1) || (msgs[i].len > 256)
+			|| ( (i + 1 < count) && (msgs[i + 1].len > 255)))
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		memset(&req, 0, sizeof(req));
+		req.bus = gDaemonBus[fd];
+		req.slave = msgs[i].addr;
+		req.add = msgs[i].buf[0];
+		req.tag = (uint16_t)(tag + n);
+		if ( (i + 1 < count) && (msgs[i + 1].flags & I2C_M_RD)
+			&& (msgs[i].len == 1))
+		{
+			// address write + read pair
+			req.op = DAEMON_OP_READ;
+			req.len = msgs[i + 1].len;
+			reqMsg[n++] = ++i;
+			memcpy(&buf[len], &req, sizeof(req));
+			len += sizeof(req);
+			continue;
+		}
+		req.op = DAEMON_OP_WRITE;
+		req.len = msgs[i].len - 1;
+		reqMsg[n++] = -1;
+		memcpy(&buf[len], &req, sizeof(req));
+		len += sizeof(req);
+		memcpy(&buf[len], &msgs[i].buf[1], req.len);
+		len += req.len;
+	}
+	gDaemonTag[fd] = (uint16_t)(tag + n);
+	if (daemonIo(fd, buf, len, 0) != 0)
+	{
+		return -1;
+	}
+	// every response is read before the first error is reported, the next
+	// transfer starts on a clean stream
+	for (i = 0; i < n; i++)
+	{
+		if ( (daemonIo(fd, &resp, sizeof(resp), 1) != 0)
+			|| ( (resp.len > 0) && (daemonIo(fd, buf, resp.len, 1) != 0)))
+		{
+			shutdown(fd, SHUT_RDWR);
+			return -1;
+		}
+		if (resp.tag != (uint16_t)(tag + i))
+		{
+			// out of sync, the connection can not be used any more
+			shutdown(fd, SHUT_RDWR);
+			errno = EPROTO;
+			return -1;
+		}
+		if ( (resp.status != 0) && (status == 0))
+		{
+			status = resp.status;
+		}
+		if ( (resp.status == 0) && (reqMsg[i] >= 0)
+			&& (resp.len == msgs[reqMsg[i]].len))
+		{
+			memcpy(msgs[reqMsg[i]].buf, buf, resp.len);
+		}
+	}
+	if (status != 0)
+	{
+		// the daemon already retried, do not retry again
+		errno = EIO;
+		return -1;
+	}
+	return count;
+}
+
+static void daemonClose(int fd)
+{
+	close(fd);
+}
+
+const I2cTransportType I2C_TRANSPORT_DAEMON =
+{
+	"daemon",
+	&daemonOpen,
+	&daemonTransfer,
+	NULL,
+	&daemonClose,
+	0,
+};
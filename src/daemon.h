@@ -0,0 +1,52 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+#include "cli.h"
+
+#define DAEMON_NAME	"16inpindd"
+#define DAEMON_SOCKET	"/run/16inpind.sock"
+#define DAEMON_SOCKET_ENV	"SM16INPIND_SOCKET"
+
+/*
+ * Client protocol, on a local stream socket, little endian.
+ * Every request gets one response with the same tag, in order.
+ * Clients may send many requests before reading the responses.
+ *   request:  DaemonReqType + len data bytes for DAEMON_OP_WRITE
+ *   response: DaemonRespType + len data bytes for DAEMON_OP_READ
+ * Status is 0 on success, EACCES for a slave outside the card addresses
+ * (0x20..0x27) or a bus the daemon was not started for (--bus).
+ */
+enum
+{
+	DAEMON_OP_PING = 0,
+	DAEMON_OP_READ,
+	DAEMON_OP_WRITE,
+};
+
+typedef struct __attribute__((packed))
+{
+	uint8_t op;
+	uint8_t bus;
+	uint8_t slave; // 7 bit I2C address
+	uint8_t add; // register address
+	uint8_t len;
+	uint8_t reserved;
+	uint16_t tag;
+} DaemonReqType;
+
+typedef struct __attribute__((packed))
+{
+	uint8_t op;
+	uint8_t status;
+	uint8_t len;
+	uint8_t reserved;
+	uint16_t tag;
+} DaemonRespType;
+
+extern const CliCmdType CMD_DAEMON;
+
+int doDaemon(int argc, char *argv[]);
+int daemonInvoked(const char* arg0);
+
+#endif /* DAEMON_H */
@@ -0,0 +1,222 @@
+/*
+ * fanout.c:
+ *	One command run on several boards in one process: the boards of a
+ *	bus are found with one frame read, the registers of the command are
+ *	prefetched for all of them in one frame, under the bus lock for that
+ *	frame only.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "comm.h"
+#include "data.h"
+#include "fanout.h"
+#include "shadow.h"
+
+// Registers read by a read command, prefetched on every target board
+typedef struct
+{
+	const char* cmd;
+	int add;
+	int size;
+} FanoutRangeType;
+
+static const FanoutRangeType gFanoutRange[] =
+{
+	{ "rd", INPUTS16_INPORT_REG_ADD, 2 },
+	{ "board", I2C_MEM_REVISION_MAJOR_ADD, 2 },
+	{ "optrd", I2C_MEM_OPTO, 2 },
+	{ "optedgerd", I2C_MEM_OPTO_IT_RISING_ADD, 4 },
+	{ "optcntrd", I2C_MEM_OPTO_EDGE_COUNT_ADD, COUNTER_SIZE * OPTO_CH_NO },
+	{ "optencrd", I2C_MEM_OPTO_ENC_ENABLE_ADD, 1 },
+	{ "optcntencrd", I2C_MEM_OPTO_ENC_COUNT_ADD, COUNTER_SIZE * OPTO_ENC_CH_NO },
+	{ "optfrd", I2C_MEM_IN_FREQENCY, IN_FREQENCY_SIZE * OPTO_CH_NO },
+	{ "optpwmrd", I2C_MEM_PWM_IN_FILL, PWM_IN_FILL_SIZE * OPTO_CH_NO },
+	{ "optintrd", I2C_MEM_EXTI_EN_ADD, 2 },
+	{ "ledrd", I2C_MEM_LEDS, 2 },
+	{ "ledmrd", I2C_MEM_LED_MODE, 2 },
+	{ "ledplrd", I2C_MEM_PWR_LED_MODE, 1 },
+	{ "wdtprd", I2C_MEM_WDT_INTERVAL_GET_ADD, 2 },
+	{ "wdtiprd", I2C_MEM_WDT_INIT_INTERVAL_GET_ADD, 2 },
+	{ "wdtoprd", I2C_MEM_WDT_POWER_OFF_INTERVAL_GET_ADD, 4 },
+	{ "wdtrcrd", I2C_MEM_WDT_RESET_COUNT_ADD, 2 },
+	{ "cfg485rd", I2C_MODBUS_SETINGS_ADD, 5 }, // packed modbus settings
+
+	{ NULL, 0, 0 }
+};
+
+int fanoutIs(const char* id)
+{
+	return (strcasecmp(id, "all") == 0) || (strchr(id, ',') != NULL);
+}
+
+static int fanoutAdd(FanoutBoardType* board, int count, int size, int bus,
+	int stack, int dev)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if ( (board[i].bus == bus) && (board[i].stack == stack))
+		{
+			return count;
+		}
+	}
+	if (count < size)
+	{
+		board[count].bus = bus;
+		board[count].stack = stack;
+		board[count].dev = dev;
+		count++;
+	}
+	return count;
+}
+
+// Probe the 8 stack levels of one bus in one frame
+static int fanoutDiscover(int bus, FanoutBoardType* board, int count, int size)
+{
+	I2cReadSegType seg[FANOUT_STACK_MAX];
+	uint8_t buff[FANOUT_STACK_MAX][2];
+	int stack[FANOUT_STACK_MAX];
+	int probe = 0;
+	int n = 0;
+	int dev;
+	int i;
+
+	for (i = 0; i < FANOUT_STACK_MAX; i++)
+	{
+		dev = i2cSetupBus(bus, (i + INPUT16_HW_I2C_BASE_ADD) ^ 0x07);
+		if (dev <= 0)
+		{
+			continue;
+		}
+		seg[n].dev = dev;
+		seg[n].add = INPUTS16_INPORT_REG_ADD;
+		seg[n].buff = buff[n];
+		seg[n].size = 2;
+		stack[n] = i;
+		n++;
+	}
+	if (n == 0)
+	{
+		return count;
+	}
+	probe = i2cProbeSet(1);
+	i2cMem8ReadFrame(seg, n);
+	i2cProbeSet(probe);
+	for (i = 0; i < n; i++)
+	{
+		if (seg[i].status == 0)
+		{
+			count = fanoutAdd(board, count, size, bus, stack[i], seg[i].dev);
+		}
+	}
+	return count;
+}
+
+/*
+ * Resolve a fan-out id in the target boards, ordered by bus then as given.
+ * Returns the number of boards, -1 for an invalid list.
+ */
+int fanoutBoards(const char* id, FanoutBoardType* board, int size)
+{
+	int bus[I2C_BUS_MAX];
+	int busCount = i2cBusGet(bus, I2C_BUS_MAX);
+	int count = 0;
+	char* end = NULL;
+	int stack;
+	int dev;
+	int i;
+
+	if (strcasecmp(id, "all") == 0)
+	{
+		for (i = 0; i < busCount; i++)
+		{
+			count = fanoutDiscover(bus[i], board, count, size);
+		}
+		return count;
+	}
+	while (*id != 0)
+	{
+		stack = (int)strtol(id, &end, 10);
+		if ( (end == id) || (stack < 0) || (stack >= FANOUT_STACK_MAX)
+			|| ( (*end != ',') && (*end != 0)))
+		{
+			return -1;
+		}
+		dev = doBoardInitBus(bus[0], stack);
+		if (dev <= 0)
+		{
+			return -1;
+		}
+		count = fanoutAdd(board, count, size, bus[0], stack, dev);
+		id = *end == ',' ? end + 1 : end;
+	}
+	return count;
+}
+
+/*
+ * Prefetch the registers of the command in the shadow of every board, one
+ * frame per bus. The lock of a bus is held for its frame only, not while
+ * the command runs on the boards. A board whose prefetch failed is read
+ * again by the command. Returns ERROR if a bus lock could not be taken.
+ */
+int fanoutBegin(const char* cmd, FanoutBoardType* board, int count)
+{
+	const FanoutRangeType* r = NULL;
+	int dev[FANOUT_STACK_MAX];
+	int bus;
+	int n;
+	int i;
+
+	for (i = 0; gFanoutRange[i].cmd != NULL; i++)
+	{
+		if (strcasecmp(cmd, gFanoutRange[i].cmd) == 0)
+		{
+			r = &gFanoutRange[i];
+			break;
+		}
+	}
+	if (NULL == r)
+	{
+		return OK;
+	}
+	for (bus = 0; bus < I2C_BUS_MAX; bus++)
+	{
+		n = 0;
+		for (i = 0; i < count; i++)
+		{
+			if (board[i].bus != bus)
+			{
+				continue;
+			}
+			dev[n++] = shadowEnable(board[i].dev) == OK ? board[i].dev : -1;
+		}
+		if (n == 0)
+		{
+			continue;
+		}
+		if (i2cGroupBegin(bus) != OK)
+		{
+			fanoutEnd(board, count);
+			return ERROR;
+		}
+		shadowRefreshFrame(dev, n, r->add, r->size);
+		i2cGroupEnd(bus);
+	}
+	return OK;
+}
+
+// Drop the shadows, later reads go to the cards again
+void fanoutEnd(FanoutBoardType* board, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		shadowDisable(board[i].dev);
+	}
+}
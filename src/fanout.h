@@ -0,0 +1,26 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "comm.h"
+
+#define FANOUT_STACK_MAX	8
+#define FANOUT_BOARD_MAX	(I2C_BUS_MAX * FANOUT_STACK_MAX)
+
+// One target board of a fan-out command
+typedef struct
+{
+	int bus;
+	int stack;
+	int dev;
+} FanoutBoardType;
+
+/*
+ * "all" (the boards found on the selected buses) or a list of stack
+ * levels "0,2,5" (on the first selected bus) in place of the board id.
+ */
+int fanoutIs(const char* id);
+int fanoutBoards(const char* id, FanoutBoardType* board, int size);
+int fanoutBegin(const char* cmd, FanoutBoardType* board, int count);
+void fanoutEnd(FanoutBoardType* board, int count);
+
+#endif /* FANOUT_H */
@@ -0,0 +1,185 @@
+/*
+ * gpio.c:
+ *	Card interrupt line through the gpiochip character device (uAPI v2)
+ *	or an emulated source for tests.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/gpio.h>
+
+#include "data.h"
+#include "gpio.h"
+
+#define GPIO_EMU_PREFIX	"fifo:"
+#define GPIO_CHIP_PREFIX	"/dev/gpiochip"
+#define GPIO_EVENT_MAX	16
+
+static const char* gGpioSpec = NULL;
+
+void gpioEventSpecSet(const char* spec)
+{
+	gGpioSpec = spec;
+}
+
+static const char* gpioEventSpec(void)
+{
+	const char* env = getenv(GPIO_SPEC_ENV);
+
+	if (gGpioSpec != NULL)
+	{
+		return gGpioSpec;
+	}
+	if ( (env != NULL) && (*env != 0))
+	{
+		return env;
+	}
+	return GPIO_SPEC_DEFAULT;
+}
+
+static int gpioEmuOpen(const char* path)
+{
+	// a test source: a setuid run would create the fifo as root anywhere
+	if ( (getuid() != geteuid()) || (getgid() != getegid()))
+	{
+		printf("The fifo interrupt line is refused in a setuid run\n");
+		return -1;
+	}
+	if ( (mkfifo(path, 0666) < 0) && (errno != EEXIST))
+	{
+		return -1;
+	}
+	// opened read-write: the fifo never reports end of file
+	return open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+}
+
+static int gpioLineOpen(const char* spec)
+{
+	struct gpio_v2_line_request req;
+	char chip[64];
+	const char* sep = strrchr(spec, ':');
+	int fd;
+
+	if ( (sep == NULL) || (sep == spec) || (sep - spec >= (int)sizeof(chip) - 6))
+	{
+		return -1;
+	}
+	snprintf(chip, sizeof(chip), "%s%.*s", spec[0] == '/' ? "" : "/dev/",
+		(int)(sep - spec), spec);
+	// a gpiochip device only: a setuid run would open any path as root
+	if ( (strncmp(chip, GPIO_CHIP_PREFIX, strlen(GPIO_CHIP_PREFIX)) != 0)
+		|| (chip[strlen(GPIO_CHIP_PREFIX)] == 0)
+		|| (strspn(&chip[strlen(GPIO_CHIP_PREFIX)], "0123456789")
+			!= strlen(&chip[strlen(GPIO_CHIP_PREFIX)])))
+	{
+		printf("The interrupt line must be on a /dev/gpiochip<n> device\n");
+		return -1;
+	}
+	fd = open(chip, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = atoi(sep + 1);
+	req.num_lines = 1;
+	strncpy(req.consumer, PROGRAM_NAME, sizeof(req.consumer) - 1);
+	// the interrupt output is open drain, active low
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING
+		| GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+	if (ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return req.fd;
+}
+
+int gpioEventOpen(GpioEventType* ev)
+{
+	const char* spec = gpioEventSpec();
+
+	if (NULL == ev)
+	{
+		return ERROR;
+	}
+	ev->emu = strncmp(spec, GPIO_EMU_PREFIX, strlen(GPIO_EMU_PREFIX)) == 0;
+	if (ev->emu)
+	{
+		ev->fd = gpioEmuOpen(spec + strlen(GPIO_EMU_PREFIX));
+	}
+	else
+	{
+		ev->fd = gpioLineOpen(spec);
+	}
+	if (ev->fd < 0)
+	{
+		printf("Fail to open the interrupt line %s\n", spec);
+		return ERROR;
+	}
+	return OK;
+}
+
+/*
+ * Wait for the line to fire, the events already queued are drained and
+ * reported as one. Returns the number of events, 0 on timeout (-1 waits
+ * for ever) or -1, tsNs is the CLOCK_MONOTONIC time of the last event.
+ */
+int gpioEventWait(GpioEventType* ev, int timeoutMs, uint64_t* tsNs)
+{
+	struct gpio_v2_line_event event[GPIO_EVENT_MAX];
+	struct pollfd pfd;
+	struct timespec ts;
+	ssize_t n;
+	int ret;
+
+	pfd.fd = ev->fd;
+	pfd.events = POLLIN;
+	do
+	{
+		ret = poll(&pfd, 1, timeoutMs);
+	}
+	while ( (ret < 0) && (errno == EINTR));
+	if (ret <= 0)
+	{
+		return ret;
+	}
+	n = read(ev->fd, event, sizeof(event));
+	if (n <= 0)
+	{
+		return -1;
+	}
+	if (ev->emu)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if (tsNs != NULL)
+		{
+			*tsNs = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		}
+		return n;
+	}
+	n /= sizeof(event[0]);
+	if ( (n > 0) && (tsNs != NULL))
+	{
+		*tsNs = event[n - 1].timestamp_ns;
+	}
+	return n;
+}
+
+void gpioEventClose(GpioEventType* ev)
+{
+	if ( (NULL != ev) && (ev->fd >= 0))
+	{
+		close(ev->fd);
+		ev->fd = -1;
+	}
+}
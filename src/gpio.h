@@ -0,0 +1,26 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+#include <stdint.h>
+
+#define GPIO_SPEC_ENV	"SM16INPIND_GPIO"
+#define GPIO_SPEC_DEFAULT	"gpiochip0:4" // card interrupt line
+
+/*
+ * Edge events of the card interrupt line. The source is either a line of
+ * a /dev/gpiochip<n> device ("gpiochip0:4", "/dev/gpiochip0:4", falling
+ * edges, kernel timestamps) or an emulated one ("fifo:<path>", every byte
+ * written to the fifo is one event, refused in a setuid run).
+ */
+typedef struct
+{
+	int fd;
+	int emu;
+} GpioEventType;
+
+void gpioEventSpecSet(const char* spec);
+int gpioEventOpen(GpioEventType* ev);
+int gpioEventWait(GpioEventType* ev, int timeoutMs, uint64_t* tsNs);
+void gpioEventClose(GpioEventType* ev);
+
+#endif /* GPIO_H */
@@ -0,0 +1,102 @@
+/*
+ * hist.c:
+ *	Latency histograms, safe to record from several threads.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hist.h"
+
+static int histIndex(uint64_t val)
+{
+	int msb;
+
+	if (val < HIST_SUB_COUNT)
+	{
+		return (int)val;
+	}
+	msb = 63 - __builtin_clzll(val);
+	return (msb - HIST_SUB_BITS + 1) * HIST_SUB_COUNT
+		+ (int)( (val >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1));
+}
+
+// Highest value that falls in the bucket
+static uint64_t histBucketTop(int idx)
+{
+	int msb;
+	uint64_t sub;
+
+	if (idx < HIST_SUB_COUNT)
+	{
+		return (uint64_t)idx;
+	}
+	msb = idx / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+	sub = (uint64_t)(idx % HIST_SUB_COUNT);
+	return ( (HIST_SUB_COUNT + sub + 1) << (msb - HIST_SUB_BITS)) - 1;
+}
+
+void histReset(HistType* h)
+{
+	memset(h, 0, sizeof(HistType));
+	h->min = UINT64_MAX;
+}
+
+void histRecord(HistType* h, uint64_t val)
+{
+	uint64_t old;
+
+	__atomic_add_fetch(&h->bucket[histIndex(val)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->sum, val, __ATOMIC_RELAXED);
+	old = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+	while ( (val < old || old == 0) && !__atomic_compare_exchange_n(&h->min,
+		&old, val, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	old = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while ( (val > old) && !__atomic_compare_exchange_n(&h->max, &old, val,
+		1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+// p in [0..100]
+uint64_t histPercentile(const HistType* h, double p)
+{
+	uint64_t rank;
+	uint64_t seen = 0;
+	int i;
+
+	if (h->count == 0)
+	{
+		return 0;
+	}
+	rank = (uint64_t)(p / 100.0 * (double)h->count + 0.5);
+	if (rank < 1)
+	{
+		rank = 1;
+	}
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		seen += h->bucket[i];
+		if (seen >= rank)
+		{
+			return histBucketTop(i) < h->max ? histBucketTop(i) : h->max;
+		}
+	}
+	return h->max;
+}
+
+void histPrint(FILE* f, const char* name, const HistType* h)
+{
+	if (h->count == 0)
+	{
+		return;
+	}
+	fprintf(f, "%-10s n=%llu min=%llu avg=%llu p50=%llu p99=%llu p999=%llu max=%llu\n",
+		name, (unsigned long long)h->count, (unsigned long long)h->min,
+		(unsigned long long)(h->sum / h->count),
+		(unsigned long long)histPercentile(h, 50),
+		(unsigned long long)histPercentile(h, 99),
+		(unsigned long long)histPercentile(h, 99.9),
+		(unsigned long long)h->max);
+}
@@ -0,0 +1,29 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Log-linear (HDR style) histogram: 16 linear sub-buckets per power of
+ * two, so any recorded value is kept with at most 1/16 relative error.
+ */
+#define HIST_SUB_BITS	4
+#define HIST_SUB_COUNT	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct
+{
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint32_t bucket[HIST_BUCKETS];
+} HistType;
+
+void histReset(HistType* h);
+void histRecord(HistType* h, uint64_t val);
+uint64_t histPercentile(const HistType* h, double p);
+void histPrint(FILE* f, const char* name, const HistType* h);
+
+#endif /* HIST_H */
@@ -0,0 +1,55 @@
+/*
+ * i2cdev.c:
+ *	Linux i2c-dev bus backend
+ */
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+#include "transport.h"
+
+static int i2cDevOpen(int bus)
+{
+	char filename[40];
+
+	sprintf(filename, "/dev/i2c-%d", bus);
+	return open(filename, O_RDWR | O_CLOEXEC);
+}
+
+static int i2cDevTransfer(int fd, struct i2c_msg* msgs, int count)
+{
+	struct i2c_rdwr_ioctl_data rdwr;
+
+	rdwr.msgs = msgs;
+	rdwr.nmsgs = count;
+	return ioctl(fd, I2C_RDWR, &rdwr);
+}
+
+static void i2cDevAdapter(int fd, int timeoutMs, int retries)
+{
+	if (timeoutMs > 0)
+	{
+		ioctl(fd, I2C_TIMEOUT, (long)( (timeoutMs + 9) / 10)); // 10 ms units
+	}
+	if (retries >= 0)
+	{
+		ioctl(fd, I2C_RETRIES, (long)retries);
+	}
+}
+
+static void i2cDevClose(int fd)
+{
+	close(fd);
+}
+
+const I2cTransportType I2C_TRANSPORT_DEV =
+{
+	"i2c-dev",
+	&i2cDevOpen,
+	&i2cDevTransfer,
+	&i2cDevAdapter,
+	&i2cDevClose,
+	1,
+};
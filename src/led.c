@@ -4,6 +4,7 @@
 
 #include "comm.h"
 #include "led.h"
+#include "out.h"
 #include "data.h"
 
 const CliCmdType CMD_LED_READ = {
@@ -30,14 +31,17 @@ int doLedRead(int argc, char *argv[]) {
                 return ERROR;
             }
             uint16_t val = (buf[1] << 8) | buf[0]; // 16-bit LED status
+            outArrayBegin("state");
             for(int led = 1; led <= LED_CH_NO; ++led) {
                 if(val & (1 << (led - 1))) {
-                    printf("1 ");
+                    outText("1 ");
                 } else {
-                    printf("0 ");
+                    outText("0 ");
                 }
+                outInt(NULL, (val >> (led - 1)) & 1);
             }
-            printf("\n");
+            outArrayEnd();
+            outText("\n");
         }
         else if(argc == 4) { // LED index specified -> read specified LED
             uint8_t buf[2];
@@ -53,10 +57,12 @@ int doLedRead(int argc, char *argv[]) {
             }
             // Print the state of the specified LED
             if(val & (1 << (led - 1))) {
-                printf("1\n"); /* LED ON */
+                outText("1\n"); /* LED ON */
             } else {
-                printf("0\n"); /* LED OFF */
+                outText("0\n"); /* LED OFF */
             }
+            outInt("led", led);
+            outInt("state", (val >> (led - 1)) & 1);
         }
         return OK;
 } 
@@ -202,7 +208,7 @@ int doLedModeRead(int argc, char *argv[])
 	dev = doBoardInit(atoi(argv[1]));
 	if (dev <= 0)
 	{
-		exit(1);
+		return ERROR;
 	}
 
 	if (argc == 4)
@@ -211,20 +217,22 @@ int doLedModeRead(int argc, char *argv[])
 		if ( (ch < MIN_CH_NO) || (ch > LED_CH_NO))
 		{
 			printf("RTD channel number value out of range!\n");
-			exit(1);
+			return ARG_RANGE_ERROR;
 		}
 
 		if (OK != ledGetMode(dev, ch, &val))
 		{
 			printf("Fail to read!\n");
-			exit(1);
+			return ERROR;
 		}
-		printf("%d\n", val);
+		outText("%d\n", val);
+		outInt("led", ch);
+		outInt("mode", val);
 	}
 	else
 	{
 		printf("Invalid arguments number for %s cmd\n", argv[0]);
-		exit(1);
+		return ARG_CNT_ERR;
 	}
 	return OK;
 }
@@ -238,7 +246,7 @@ int doLedModeWrite(int argc, char *argv[])
 	dev = doBoardInit(atoi(argv[1]));
 	if (dev <= 0)
 	{
-		exit(1);
+		return ERROR;
 	}
 
 	if (argc == 5)
@@ -247,7 +255,7 @@ int doLedModeWrite(int argc, char *argv[])
 		if ( (ch < MIN_CH_NO) || (ch > LED_CH_NO))
 		{
 			printf("RTD channel number value out of range!\n");
-			exit(1);
+			return ARG_RANGE_ERROR;
 		}
 
 		val = atoi(argv[4]);
@@ -255,13 +263,13 @@ int doLedModeWrite(int argc, char *argv[])
 		if (OK != ledSetMode(dev, ch, val))
 		{
 			printf("Fail to write!\n");
-			exit(1);
+			return ERROR;
 		}
 	}
 	else
 	{
 		printf("Invalid arguments number for %s cmd\n", argv[0]);
-		exit(1);
+		return ARG_CNT_ERR;
 	}
 	return OK;
 }
@@ -332,7 +340,7 @@ int doPowerLedModeRead(int argc, char *argv[])
 	dev = doBoardInit(atoi(argv[1]));
 	if (dev <= 0)
 	{
-		exit(1);
+		return ERROR;
 	}
 
 	if (argc == 3)
@@ -340,14 +348,15 @@ int doPowerLedModeRead(int argc, char *argv[])
 		if (OK != powerLedGetMode(dev, &val))
 		{
 			printf("Fail to read!\n");
-			exit(1);
+			return ERROR;
 		}
-		printf("%d\n", val);
+		outText("%d\n", val);
+		outInt("mode", val);
 	}
 	else
 	{
 		printf("Invalid arguments number for %s cmd\n", argv[0]);
-		exit(1);
+		return ARG_CNT_ERR;
 	}
 	return OK;
 }
@@ -360,7 +369,7 @@ int doPowerLedModeWrite(int argc, char *argv[])
 	dev = doBoardInit(atoi(argv[1]));
 	if (dev <= 0)
 	{
-		exit(1);
+		return ERROR;
 	}
 
 	if (argc == 4)
@@ -370,13 +379,13 @@ int doPowerLedModeWrite(int argc, char *argv[])
 		if (OK != powerLedSetMode(dev, val))
 		{
 			printf("Fail to write!\n");
-			exit(1);
+			return ERROR;
 		}
 	}
 	else
 	{
 		printf("Invalid arguments number for %s cmd\n", argv[0]);
-		exit(1);
+		return ARG_CNT_ERR;
 	}
 	return OK;
 }
@@ -7,5 +7,10 @@ extern const CliCmdType CMD_LED_MODE_WRITE;
 extern const CliCmdType CMD_POWER_LED_MODE_READ;
 extern const CliCmdType CMD_POWER_LED_MODE_WRITE;
 
+int ledGetMode(int dev, int ch, int* val);
+int ledSetMode(int dev, int ch, int val);
+int powerLedGetMode(int dev, int* val);
+int powerLedSetMode(int dev, int val);
+
 int doLedRead(int argc, char *argv[]);
 int doLedWrite(int argc, char *argv[]);
@@ -0,0 +1,195 @@
+/*
+ * loop.c:
+ *	In-process loopback bus backend, lets the whole tool run without
+ *	the hardware. Unless a model is attached, every bus opened gets a
+ *	plain register memory at each of the eight card addresses.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "comm.h"
+#include "data.h"
+#include "transport.h"
+
+#define LOOP_SLAVE_MAX	128
+
+typedef struct
+{
+	LoopDevType model;
+	int pointer; // register address auto-incremented like on the card
+} LoopSlaveType;
+
+typedef struct
+{
+	uint8_t mem[I2C_MEM_SIZE];
+} LoopMemType;
+
+static pthread_mutex_t gLoopLock = PTHREAD_MUTEX_INITIALIZER;
+static LoopSlaveType* gLoopSlave[I2C_BUS_MAX][LOOP_SLAVE_MAX];
+
+static int loopMemRead(void* ctx, int add, uint8_t* buff, int size)
+{
+	memcpy(buff, &((LoopMemType*)ctx)->mem[add], size);
+	return 0;
+}
+
+static int loopMemWrite(void* ctx, int add, const uint8_t* buff, int size)
+{
+	memcpy(&((LoopMemType*)ctx)->mem[add], buff, size);
+	return 0;
+}
+
+static int loopAttachLocked(int bus, int slave, const LoopDevType* model)
+{
+	LoopSlaveType* s = NULL;
+
+	if ( (bus < 0) || (bus >= I2C_BUS_MAX) || (slave < 0)
+		|| (slave >= LOOP_SLAVE_MAX) || (NULL == model))
+	{
+		return -1;
+	}
+	s = gLoopSlave[bus][slave];
+	if (NULL == s)
+	{
+		s = calloc(1, sizeof(LoopSlaveType));
+		if (NULL == s)
+		{
+			return -1;
+		}
+		gLoopSlave[bus][slave] = s;
+	}
+	s->model = *model;
+	s->pointer = 0;
+	return 0;
+}
+
+int loopAttach(int bus, int slave, const LoopDevType* model)
+{
+	int ret;
+
+	pthread_mutex_lock(&gLoopLock);
+	ret = loopAttachLocked(bus, slave, model);
+	pthread_mutex_unlock(&gLoopLock);
+	return ret;
+}
+
+void loopDetach(int bus, int slave)
+{
+	if ( (bus < 0) || (bus >= I2C_BUS_MAX) || (slave < 0)
+		|| (slave >= LOOP_SLAVE_MAX))
+	{
+		return;
+	}
+	pthread_mutex_lock(&gLoopLock);
+	free(gLoopSlave[bus][slave]);
+	gLoopSlave[bus][slave] = NULL;
+	pthread_mutex_unlock(&gLoopLock);
+}
+
+static int loopOpen(int bus)
+{
+	LoopDevType model;
+	int stack;
+	int slave;
+
+	if ( (bus < 0) || (bus >= I2C_BUS_MAX))
+	{
+		return -1;
+	}
+	pthread_mutex_lock(&gLoopLock);
+	for (slave = 0; slave < LOOP_SLAVE_MAX; slave++)
+	{
+		if (gLoopSlave[bus][slave] != NULL)
+		{
+			break;
+		}
+	}
+	if (slave == LOOP_SLAVE_MAX)
+	{
+		for (stack = 0; stack < 8; stack++)
+		{
+			model.read = loopMemRead;
+			model.write = loopMemWrite;
+			model.ctx = calloc(1, sizeof(LoopMemType));
+			if (model.ctx != NULL)
+			{
+				loopAttachLocked(bus,
+					(stack + INPUT16_HW_I2C_BASE_ADD) ^ 0x07, &model);
+			}
+		}
+	}
+	pthread_mutex_unlock(&gLoopLock);
+	return bus;
+}
+
+static int loopTransfer(int fd, struct i2c_msg* msgs, int count)
+{
+	LoopSlaveType* s = NULL;
+	int size = 0;
+	int i;
+
+	pthread_mutex_lock(&gLoopLock);
+	for (i = 0; i < count; i++)
+	{
+		s = msgs[i].addr < LOOP_SLAVE_MAX ? gLoopSlave[fd][msgs[i].addr] : NULL;
+		if (NULL == s)
+		{
+			pthread_mutex_unlock(&gLoopLock);
+			errno = EREMOTEIO; // nobody acknowledged the address
+			return -1;
+		}
+		size = msgs[i].len;
+		if (msgs[i].flags & I2C_M_RD)
+		{
+			if (s->pointer + size > I2C_MEM_SIZE)
+			{
+				size = I2C_MEM_SIZE - s->pointer;
+			}
+			memset(msgs[i].buf, 0xff, msgs[i].len);
+			if ( (size > 0)
+				&& (s->model.read(s->model.ctx, s->pointer, msgs[i].buf, size) != 0))
+			{
+				pthread_mutex_unlock(&gLoopLock);
+				errno = EIO;
+				return -1;
+			}
+		}
+		else if (size > 0)
+		{
+			s->pointer = msgs[i].buf[0];
+			size--;
+			if (s->pointer + size > I2C_MEM_SIZE)
+			{
+				size = I2C_MEM_SIZE - s->pointer;
+			}
+			if ( (size > 0)
+				&& (s->model.write(s->model.ctx, s->pointer, &msgs[i].buf[1], size)
+					!= 0))
+			{
+				pthread_mutex_unlock(&gLoopLock);
+				errno = EIO;
+				return -1;
+			}
+		}
+		s->pointer = (s->pointer + size) % I2C_MEM_SIZE;
+	}
+	pthread_mutex_unlock(&gLoopLock);
+	return count;
+}
+
+static void loopClose(int fd)
+{
+	(void)fd;
+}
+
+const I2cTransportType I2C_TRANSPORT_LOOP =
+{
+	"loop",
+	&loopOpen,
+	&loopTransfer,
+	NULL,
+	&loopClose,
+	0,
+};
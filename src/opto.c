@@ -1,11 +1,16 @@
 #include <stdbool.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 
 #include "comm.h"
 #include "data.h"
+#include "gpio.h"
+#include "out.h"
 #include "opto.h"
 
 // TODO: Add ranges in all error messages
@@ -172,6 +177,23 @@ int optoCountGet(int dev, uint8_t ch, uint32_t *val)
 	return OK ;
 }
 
+// Edge counters of all the channels in one read, val[OPTO_CH_NO]
+int optoCountGetAll(int dev, uint32_t *val)
+{
+	uint8_t buf[COUNTER_SIZE * OPTO_CH_NO];
+
+	if (NULL == val)
+	{
+		return ERROR ;
+	}
+	if (OK != i2cMem8Read(dev, I2C_MEM_OPTO_EDGE_COUNT_ADD, buf, sizeof(buf)))
+	{
+		return ERROR ;
+	}
+	memcpy(val, buf, sizeof(buf));
+	return OK ;
+}
+
 int optoFreqGet(int dev, uint8_t ch, uint16_t *val)
 {
 	if (badOptoCh(ch))
@@ -194,6 +216,23 @@ int optoFreqGet(int dev, uint8_t ch, uint16_t *val)
 	return OK ;
 }
 
+// Frequencies of all the channels in one read, val[OPTO_CH_NO]
+int optoFreqGetAll(int dev, uint16_t *val)
+{
+	uint8_t buf[OPTO_FREQUENCY_DATA_SIZE * OPTO_CH_NO];
+
+	if (NULL == val)
+	{
+		return ERROR ;
+	}
+	if (OK != i2cMem8Read(dev, I2C_MEM_IN_FREQENCY, buf, sizeof(buf)))
+	{
+		return ERROR ;
+	}
+	memcpy(val, buf, sizeof(buf));
+	return OK ;
+}
+
 int optoPWMFillGet(int dev, uint8_t ch, float *val)
 {
 	if (badOptoCh(ch))
@@ -218,6 +257,29 @@ int optoPWMFillGet(int dev, uint8_t ch, float *val)
 	return OK ;
 }
 
+// PWM fill factors of all the channels in one read, val[OPTO_CH_NO]
+int optoPWMFillGetAll(int dev, float *val)
+{
+	uint8_t buf[OPTO_FREQUENCY_DATA_SIZE * OPTO_CH_NO];
+	uint16_t raw = 0;
+	int i;
+
+	if (NULL == val)
+	{
+		return ERROR ;
+	}
+	if (OK != i2cMem8Read(dev, I2C_MEM_PWM_IN_FILL, buf, sizeof(buf)))
+	{
+		return ERROR ;
+	}
+	for (i = 0; i < OPTO_CH_NO; i++)
+	{
+		memcpy(&raw, &buf[OPTO_FREQUENCY_DATA_SIZE * i], OPTO_FREQUENCY_DATA_SIZE);
+		val[i] = (float)raw / OPTO_FILL_FACTOR_SCALE;
+	}
+	return OK ;
+}
+
 int optoCountReset(int dev, uint8_t ch)
 {
 	if (badOptoCh(ch))
@@ -305,6 +367,23 @@ int optoEncGetCnt(int dev, uint8_t ch, int *val)
 	return OK ;
 }
 
+// Counters of all the encoders in one read, val[OPTO_ENC_CH_NO]
+int optoEncGetCntAll(int dev, int *val)
+{
+	uint8_t buf[COUNTER_SIZE * OPTO_ENC_CH_NO];
+
+	if (NULL == val)
+	{
+		return ERROR ;
+	}
+	if (OK != i2cMem8Read(dev, I2C_MEM_OPTO_ENC_COUNT_ADD, buf, sizeof(buf)))
+	{
+		return ERROR ;
+	}
+	memcpy(val, buf, sizeof(buf));
+	return OK ;
+}
+
 int optoEncRstCnt(int dev, uint8_t ch)
 {
 	if (badOptoEncCh(ch))
@@ -409,12 +488,14 @@ int doOptoRead(int argc, char *argv[])
 		}
 		if (state != OFF)
 		{
-			printf("1\n");
+			outText("1\n");
 		}
 		else
 		{
-			printf("0\n");
+			outText("0\n");
 		}
+		outInt("channel", channel);
+		outInt("state", state != OFF);
 	}
 	else if (argc == 3)
 	{
@@ -424,7 +505,8 @@ int doOptoRead(int argc, char *argv[])
 			printf("Fail to read!\n");
 			return ERROR ;
 		}
-		printf("%d\n", val);
+		outText("%d\n", val);
+		outInt("inputs", val);
 	}
 	else
 	{
@@ -464,7 +546,9 @@ int doOptoEdgeRead(int argc, char *argv[])
 		printf("Fail to read!\n");
 		return ERROR ;
 	}
-	printf("%d\n", val);
+	outText("%d\n", val);
+	outInt("channel", channel);
+	outInt("edge", val);
 	return OK ;
 }
 
@@ -536,13 +620,14 @@ const CliCmdType CMD_OPTO_CNT_READ =
 	"optcntrd",
 	2,
 	&doOptoCntRead,
-	"  optcntrd         Read optocoupled inputs edges count for one channel\n",
-	"  Usage:           "PROGRAM_NAME" <id> optcntrd <channel>\n",
+	"  optcntrd         Read optocoupled inputs edges count for one channel or all channels\n",
+	"  Usage:           "PROGRAM_NAME" <id> optcntrd <channel>\n"
+	"  Usage:           "PROGRAM_NAME" <id> optcntrd\n",
 	"  Example:         "PROGRAM_NAME" 0 optcntrd 2; Read contor of opto input #2 on Board #0\n"
 };
 int doOptoCntRead(int argc, char *argv[])
 {
-	if (argc != 4)
+	if (argc != 3 && argc != 4)
 	{
 		return ARG_CNT_ERR;
 	}
@@ -551,6 +636,24 @@ int doOptoCntRead(int argc, char *argv[])
 	{
 		return ERROR ;
 	}
+	if (argc == 3)
+	{
+		uint32_t all[OPTO_CH_NO];
+		if (OK != optoCountGetAll(dev, all))
+		{
+			printf("Fail to read!\n");
+			return ERROR ;
+		}
+		outArrayBegin("count");
+		for (int i = 0; i < OPTO_CH_NO; i++)
+		{
+			outText(i ? " %u" : "%u", all[i]);
+			outInt(NULL, all[i]);
+		}
+		outArrayEnd();
+		outText("\n");
+		return OK ;
+	}
 	uint8_t channel = 0;
 	channel = atoi(argv[3]);
 	if (badOptoCh(channel))
@@ -564,7 +667,9 @@ int doOptoCntRead(int argc, char *argv[])
 		printf("Fail to read!\n");
 		return ERROR ;
 	}
-	printf("%u\n", val);
+	outText("%u\n", val);
+	outInt("channel", channel);
+	outInt("count", val);
 	return OK ;
 }
 
@@ -635,7 +740,9 @@ int doOptoEncoderRead(int argc, char *argv[])
 		printf("Fail to read!\n");
 		return ERROR ;
 	}
-	printf("%d\n", val);
+	outText("%d\n", val);
+	outInt("channel", channel);
+	outInt("enabled", val);
 	return OK ;
 }
 
@@ -681,13 +788,14 @@ const CliCmdType CMD_OPTO_ENC_CNT_READ =
 	"optcntencrd",
 	2,
 	&doOptoEncoderCntRead,
-	"  optcntencrd      Read optocoupled encoder count for one channel\n",
-	"  Usage:           "PROGRAM_NAME" <id> optcntencrd <channel>\n",
+	"  optcntencrd      Read optocoupled encoder count for one channel or all channels\n",
+	"  Usage:           "PROGRAM_NAME" <id> optcntencrd <channel>\n"
+	"  Usage:           "PROGRAM_NAME" <id> optcntencrd\n",
 	"  Example:         "PROGRAM_NAME" 0 optcntencrd 2; Read contor of opto encoder #2 on Board #0\n"
 };
 int doOptoEncoderCntRead(int argc, char *argv[])
 {
-	if (argc != 4)
+	if (argc != 3 && argc != 4)
 	{
 		return ARG_CNT_ERR;
 	}
@@ -696,6 +804,24 @@ int doOptoEncoderCntRead(int argc, char *argv[])
 	{
 		return ERROR ;
 	}
+	if (argc == 3)
+	{
+		int all[OPTO_ENC_CH_NO];
+		if (OK != optoEncGetCntAll(dev, all))
+		{
+			printf("Fail to read!\n");
+			return ERROR ;
+		}
+		outArrayBegin("count");
+		for (int i = 0; i < OPTO_ENC_CH_NO; i++)
+		{
+			outText(i ? " %d" : "%d", all[i]);
+			outInt(NULL, all[i]);
+		}
+		outArrayEnd();
+		outText("\n");
+		return OK ;
+	}
 	uint8_t channel = atoi(argv[3]);
 	if (badOptoEncCh(channel))
 	{
@@ -707,7 +833,9 @@ int doOptoEncoderCntRead(int argc, char *argv[])
 		printf("Fail to read!\n");
 		return ERROR ;
 	}
-	printf("%d\n", val);
+	outText("%d\n", val);
+	outInt("channel", channel);
+	outInt("count", val);
 	return OK ;
 }
 
@@ -750,13 +878,14 @@ const CliCmdType CMD_OPTO_FREQUENCY_READ =
 	"optfrd",
 	2,
 	&doOptoFreqRead,
-	"  optfrd         Read optocoupled inputs signal frequency in Hz for one channel\n",
-	"  Usage:           "PROGRAM_NAME" <id> optfrd <channel>\n",
+	"  optfrd         Read optocoupled inputs signal frequency in Hz for one channel or all channels\n",
+	"  Usage:           "PROGRAM_NAME" <id> optfrd <channel>\n"
+	"  Usage:           "PROGRAM_NAME" <id> optfrd\n",
 	"  Example:         "PROGRAM_NAME" 0 optfrd 2; Read the frequency of the sygnal applied to opto input #2 on Board #0\n"
 };
 int doOptoFreqRead(int argc, char *argv[])
 {
-	if (argc != 4)
+	if (argc != 3 && argc != 4)
 	{
 		return ARG_CNT_ERR;
 	}
@@ -765,6 +894,24 @@ int doOptoFreqRead(int argc, char *argv[])
 	{
 		return ERROR ;
 	}
+	if (argc == 3)
+	{
+		uint16_t all[OPTO_CH_NO];
+		if (OK != optoFreqGetAll(dev, all))
+		{
+			printf("Fail to read!\n");
+			return ERROR ;
+		}
+		outArrayBegin("freq");
+		for (int i = 0; i < OPTO_CH_NO; i++)
+		{
+			outText(i ? " %d" : "%d", (int)all[i]);
+			outInt(NULL, all[i]);
+		}
+		outArrayEnd();
+		outText("\n");
+		return OK ;
+	}
 	uint8_t channel = 0;
 	channel = atoi(argv[3]);
 	if (badOptoCh(channel))
@@ -778,7 +925,9 @@ int doOptoFreqRead(int argc, char *argv[])
 		printf("Fail to read!\n");
 		return ERROR ;
 	}
-	printf("%d\n", (int)val);
+	outText("%d\n", (int)val);
+	outInt("channel", channel);
+	outInt("freq", val);
 	return OK ;
 }
 
@@ -787,13 +936,14 @@ const CliCmdType CMD_OPTO_PWM_READ =
 	"optpwmrd",
 	2,
 	&doOptoPWMRead,
-	"  optpwmrd         Read optocoupled inputs signal pwm fill factor (\%), \n",
-	"  Usage:           "PROGRAM_NAME" <id> optpwmrd <channel>\n",
+	"  optpwmrd         Read optocoupled inputs signal pwm fill factor (\%) for one channel or all channels\n",
+	"  Usage:           "PROGRAM_NAME" <id> optpwmrd <channel>\n"
+	"  Usage:           "PROGRAM_NAME" <id> optpwmrd\n",
 	"  Example:         "PROGRAM_NAME" 0 optpwmrd 2; Read the pwm fill factor of the sygnal applied to opto input #2 on Board #0\n"
 };
 int doOptoPWMRead(int argc, char *argv[])
 {
-	if (argc != 4)
+	if (argc != 3 && argc != 4)
 	{
 		return ARG_CNT_ERR;
 	}
@@ -802,6 +952,24 @@ int doOptoPWMRead(int argc, char *argv[])
 	{
 		return ERROR ;
 	}
+	if (argc == 3)
+	{
+		float all[OPTO_CH_NO];
+		if (OK != optoPWMFillGetAll(dev, all))
+		{
+			printf("Fail to read!\n");
+			return ERROR ;
+		}
+		outArrayBegin("fill");
+		for (int i = 0; i < OPTO_CH_NO; i++)
+		{
+			outText(i ? " %.02f" : "%.02f", all[i]);
+			outFloat(NULL, all[i]);
+		}
+		outArrayEnd();
+		outText("\n");
+		return OK ;
+	}
 	uint8_t channel = 0;
 	channel = atoi(argv[3]);
 	if (badOptoCh(channel))
@@ -815,7 +983,9 @@ int doOptoPWMRead(int argc, char *argv[])
 		printf("Fail to read!\n");
 		return ERROR ;
 	}
-	printf("%.02f\n", val);
+	outText("%.02f\n", val);
+	outInt("channel", channel);
+	outFloat("fill", val);
 	return OK ;
 }
 
@@ -907,7 +1077,9 @@ int doOptoIntRd(int argc, char *argv[])
 			printf("Fail to read interrupt settings!\n");
 			return ERROR ;
 		}
-		printf("%d\n",(int)enable);
+		outText("%d\n",(int)enable);
+		outInt("channel", channel);
+		outInt("enabled", enable);
 	}
 	else //argc == 3
 	{
@@ -921,7 +1093,217 @@ int doOptoIntRd(int argc, char *argv[])
 			return ERROR ;
 		}
 		memcpy(&val, buff, 2);
-		printf("%d\n", (int)val);
+		outText("%d\n", (int)val);
+		outInt("mask", val);
 	}
 	return OK ;
-}
\ No newline at end of file
+}
+const CliCmdType CMD_OPTO_WAIT =
+{
+	"optwait",
+	2,
+	&doOptoWait,
+	"  optwait          Wait for a change of the optocoupled inputs using the card interrupt line\n",
+	"  Usage:           "PROGRAM_NAME" <id> optwait [<bitmap> [<timeout ms>]]\n",
+	"  Example:         "PROGRAM_NAME" 0 optwait 3 1000; Wait up to 1s for a change of input channel 1 or 2, display the inputs and the time of the interrupt (s)\n"
+};
+int doOptoWait(int argc, char *argv[])
+{
+	GpioEventType ev;
+	uint8_t saved[2];
+	uint8_t buff[2];
+	uint16_t mask = 0xffff;
+	uint64_t tsNs = 0;
+	int timeout = -1;
+	int prev = 0;
+	int val = 0;
+	int ret = ERROR;
+
+	if (argc < 3 || argc > 5)
+	{
+		return ARG_CNT_ERR;
+	}
+	int dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR ;
+	}
+	if (argc > 3)
+	{
+		mask = 0xffff & strtol(argv[3], NULL, 0);
+	}
+	if (argc > 4)
+	{
+		timeout = atoi(argv[4]);
+	}
+	if (OK != gpioEventOpen(&ev))
+	{
+		return ERROR ;
+	}
+	// arm the interrupt on the watched channels, restored on exit
+	memcpy(buff, &mask, 2);
+	if ( (OK != i2cMem8Read(dev, I2C_MEM_EXTI_EN_ADD, saved, 2))
+		|| (OK != i2cMem8Write(dev, I2C_MEM_EXTI_EN_ADD, buff, 2))
+		|| (OK != optoGet(dev, &prev)))
+	{
+		printf("Fail to arm the interrupt!\n");
+		gpioEventClose(&ev);
+		return ERROR ;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long end = now.tv_sec * 1000LL + now.tv_nsec / 1000000 + timeout;
+	while (1)
+	{
+		int left = timeout;
+		if (timeout >= 0)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			left = end - (now.tv_sec * 1000LL + now.tv_nsec / 1000000);
+			left = left < 0 ? 0 : left;
+		}
+		int n = gpioEventWait(&ev, left, &tsNs);
+		if (n <= 0)
+		{
+			printf(n == 0 ? "Timeout!\n" : "Fail to wait!\n");
+			break;
+		}
+		if (OK != optoGet(dev, &val))
+		{
+			printf("Fail to read!\n");
+			break;
+		}
+		if ( (val ^ prev) & mask)
+		{
+			// time of the interrupt, CLOCK_MONOTONIC from the kernel
+			outText("%d %llu.%09llu\n", val,
+				(unsigned long long)(tsNs / 1000000000ULL),
+				(unsigned long long)(tsNs % 1000000000ULL));
+			outInt("inputs", val);
+			outInt("ts_ns", tsNs);
+			ret = OK;
+			break;
+		}
+	}
+	i2cMem8Write(dev, I2C_MEM_EXTI_EN_ADD, saved, 2);
+	gpioEventClose(&ev);
+	return ret;
+}
+
+static volatile sig_atomic_t gWatchStop = 0;
+
+static void watchSignal(int sig)
+{
+	(void)sig;
+	gWatchStop = 1;
+}
+
+const CliCmdType CMD_WATCH =
+{
+	"watch",
+	2,
+	&doWatch,
+	"  watch            Sample the optocoupled inputs continuously and display every transition\n",
+	"  Usage:           "PROGRAM_NAME" <id> watch [<bitmap>] [text|bin]\n"
+	"                   With --format one record per transition, bin is the WatchEventType record\n",
+	"  Example:         "PROGRAM_NAME" 0 watch 0x0f; Display \"<time s> <channel> <rising|falling>\" for the channels 1..4 until Ctrl-C\n"
+};
+int doWatch(int argc, char *argv[])
+{
+	WatchEventType event;
+	uint16_t mask = 0xffff;
+	uint16_t diff = 0;
+	uint64_t start = 0;
+	uint64_t end = 0;
+	uint32_t errors = 0;
+	int binary = 0;
+	int prev = 0;
+	int val = 0;
+	int ch = 0;
+	int i;
+
+	if (argc < 3 || argc > 5)
+	{
+		return ARG_CNT_ERR;
+	}
+	for (i = 3; i < argc; i++)
+	{
+		if (strcasecmp(argv[i], "bin") == 0)
+		{
+			binary = 1;
+		}
+		else if (strcasecmp(argv[i], "text") != 0)
+		{
+			mask = 0xffff & strtol(argv[i], NULL, 0);
+		}
+	}
+	int dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR ;
+	}
+	if (OK != optoGet(dev, &prev))
+	{
+		fprintf(stderr, "Fail to read!\n");
+		return ERROR ;
+	}
+	signal(SIGINT, watchSignal);
+	signal(SIGTERM, watchSignal);
+	while (!gWatchStop)
+	{
+		// a failed sample is counted and skipped, like in the poller
+		if (OK != optoGet(dev, &val))
+		{
+			if (errors++ == 0)
+			{
+				fprintf(stderr, "Fail to read!\n");
+			}
+			continue;
+		}
+		i2cSampleTime(&start, &end);
+		diff = (val ^ prev) & mask;
+		if (diff == 0)
+		{
+			continue;
+		}
+		// the sample is time stamped in the middle of the transfer
+		memset(&event, 0, sizeof(event));
+		event.tsNs = start + (end - start) / 2;
+		event.inputs = val;
+		for (ch = 0; ch < OPTO_CH_NO; ch++)
+		{
+			if ( (diff & (1 << ch)) == 0)
+			{
+				continue;
+			}
+			event.ch = ch + 1;
+			event.edge = (val >> ch) & 1;
+			if (outFormat() != OUT_TEXT)
+			{
+				outInt("ts_ns", event.tsNs);
+				outInt("inputs", event.inputs);
+				outInt("channel", event.ch);
+				outInt("edge", event.edge);
+				outRecord(OK);
+			}
+			else if (binary)
+			{
+				fwrite(&event, sizeof(event), 1, stdout);
+			}
+			else
+			{
+				printf("%llu.%09llu %d %s\n",
+					(unsigned long long)(event.tsNs / 1000000000ULL),
+					(unsigned long long)(event.tsNs % 1000000000ULL), event.ch,
+					event.edge ? "rising" : "falling");
+			}
+		}
+		fflush(stdout);
+		prev = val;
+	}
+	if (errors > 0)
+	{
+		fprintf(stderr, "%u failed reads\n", errors);
+	}
+	return OK ;
+}
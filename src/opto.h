@@ -1,6 +1,7 @@
 #ifndef OPTO_H
 #define OPTO_H
 
+#include <stdint.h>
 #include "cli.h"
 
 extern const CliCmdType CMD_OPTO_READ;
@@ -16,6 +17,36 @@ extern const CliCmdType CMD_OPTO_FREQUENCY_READ;
 extern const CliCmdType CMD_OPTO_PWM_READ;
 extern const CliCmdType CMD_OPTO_INT_WR;
 extern const CliCmdType CMD_OPTO_INT_RD;
+extern const CliCmdType CMD_OPTO_WAIT;
+extern const CliCmdType CMD_WATCH;
+
+// binary record of the watch command, one per channel transition
+typedef struct
+{
+	uint64_t tsNs; // CLOCK_MONOTONIC_RAW, middle of the input read
+	uint16_t inputs; // all inputs after the transition, bit 0 = channel 1
+	uint8_t ch; // 1..16
+	uint8_t edge; // 1 - rising; 0 - falling
+	uint32_t reserved;
+} WatchEventType;
+
+int optoGet(int dev, int *val);
+int optoEdgeGet(int dev, uint8_t ch, uint8_t *val);
+int optoEdgeSet(int dev, uint8_t ch, uint8_t val);
+int optoCountGet(int dev, uint8_t ch, uint32_t *val);
+int optoCountGetAll(int dev, uint32_t *val);
+int optoFreqGet(int dev, uint8_t ch, uint16_t *val);
+int optoFreqGetAll(int dev, uint16_t *val);
+int optoPWMFillGet(int dev, uint8_t ch, float *val);
+int optoPWMFillGetAll(int dev, float *val);
+int optoCountReset(int dev, uint8_t ch);
+int optoEncStateRead(int dev, uint8_t ch, uint8_t *val);
+int optoEncStateWrite(int dev, uint8_t ch, uint8_t val);
+int optoEncGetCnt(int dev, uint8_t ch, int *val);
+int optoEncGetCntAll(int dev, int *val);
+int optoEncRstCnt(int dev, uint8_t ch);
+int optoIntSet(int dev, uint8_t ch, uint8_t val);
+int optoIntRead(int dev, uint8_t ch, uint8_t *val);
 
 int doOptoRead(int argc, char *argv[]);
 int doOptoEdgeWrite(int argc, char *argv[]);
@@ -30,4 +61,6 @@ int doOptoPWMRead(int argc, char *argv[]);
 int doOptoFreqRead(int argc, char *argv[]);
 int doOptoIntEn(int argc, char *argv[]);
 int doOptoIntRd(int argc, char *argv[]);
+int doOptoWait(int argc, char *argv[]);
+int doWatch(int argc, char *argv[]);
 #endif /* OPTO_H */
@@ -0,0 +1,499 @@
+/*
+ * out.c:
+ *	Output layer of the commands: human text or json / csv / binary
+ *	records.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "data.h"
+#include "out.h"
+
+#define OUT_FIELD_MAX	64
+#define OUT_VALUE_MAX	512
+#define OUT_STR_MAX	1024
+#define OUT_LINE_MAX	4096
+#define OUT_BIN_MAX	16384
+
+typedef struct
+{
+	const char* key;
+	char type; // 'i', 'f' or 's'
+	int array;
+	int count;
+	int first; // index in gOutValue, offset in gOutStr for strings
+} OutFieldType;
+
+typedef union
+{
+	int64_t i;
+	double f;
+} OutValueType;
+
+static OutFormatType gOutFormat = OUT_TEXT;
+static FILE* gOut = NULL;
+
+static const char* gOutCmd = "";
+static int gOutBus = -1;
+static int gOutStack = -1;
+static int gOutEmitted = 0;
+static OutFieldType gOutField[OUT_FIELD_MAX];
+static int gOutFields = 0;
+static OutValueType gOutValue[OUT_VALUE_MAX];
+static int gOutValues = 0;
+static char gOutStr[OUT_STR_MAX];
+static int gOutStrLen = 0;
+static OutFieldType* gOutArray = NULL;
+static char gOutHeader[OUT_LINE_MAX];
+
+/*
+ * Select the format by name. In the record formats stdout is kept for the
+ * records and the text printed by the commands goes to stderr, the text
+ * format gives stdout back.
+ */
+int outFormatSet(const char* name)
+{
+	static const char* names[] = { "text", "json", "csv", "bin" };
+	int fd;
+	int i;
+
+	for (i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+	{
+		if (strcasecmp(name, names[i]) == 0)
+		{
+			break;
+		}
+	}
+	if (i == (int)(sizeof(names) / sizeof(names[0])))
+	{
+		return ERROR;
+	}
+	gOutFormat = (OutFormatType)i;
+	if ( (gOutFormat == OUT_TEXT) && (gOut != NULL))
+	{
+		// back to text: stdout gets its own file again
+		fflush(stdout);
+		fflush(gOut);
+		dup2(fileno(gOut), STDOUT_FILENO);
+		fclose(gOut);
+		gOut = NULL;
+		return OK;
+	}
+	if ( (gOutFormat == OUT_TEXT) || (gOut != NULL))
+	{
+		return OK;
+	}
+	fflush(stdout);
+	fd = dup(STDOUT_FILENO);
+	if (fd < 0)
+	{
+		return ERROR;
+	}
+	gOut = fdopen(fd, "w");
+	if (NULL == gOut)
+	{
+		close(fd);
+		return ERROR;
+	}
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+	return OK;
+}
+
+OutFormatType outFormat(void)
+{
+	return gOutFormat;
+}
+
+int outText(const char* fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	if (gOutFormat != OUT_TEXT)
+	{
+		return 0;
+	}
+	va_start(ap, fmt);
+	ret = vprintf(fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+static void outReset(void)
+{
+	gOutFields = 0;
+	gOutValues = 0;
+	gOutStrLen = 0;
+	gOutArray = NULL;
+}
+
+// Open the record of a command, bus and stack are -1 without a board id
+void outBegin(const char* cmd, int bus, int stack)
+{
+	gOutCmd = cmd;
+	gOutBus = bus;
+	gOutStack = stack;
+	gOutEmitted = 0;
+	outReset();
+}
+
+static OutFieldType* outField(const char* key, char type)
+{
+	OutFieldType* f;
+
+	if (NULL != gOutArray)
+	{
+		if (gOutArray->count == 0)
+		{
+			gOutArray->type = type;
+		}
+		return gOutArray;
+	}
+	if (gOutFields >= OUT_FIELD_MAX)
+	{
+		return NULL;
+	}
+	f = &gOutField[gOutFields++];
+	f->key = key;
+	f->type = type;
+	f->array = 0;
+	f->count = 0;
+	f->first = gOutValues;
+	return f;
+}
+
+void outInt(const char* key, int64_t val)
+{
+	OutFieldType* f;
+
+	if ( (gOutFormat == OUT_TEXT) || (gOutValues >= OUT_VALUE_MAX))
+	{
+		return;
+	}
+	f = outField(key, 'i');
+	if (NULL != f)
+	{
+		gOutValue[gOutValues++].i = val;
+		f->count++;
+	}
+}
+
+void outFloat(const char* key, double val)
+{
+	OutFieldType* f;
+
+	if ( (gOutFormat == OUT_TEXT) || (gOutValues >= OUT_VALUE_MAX))
+	{
+		return;
+	}
+	f = outField(key, 'f');
+	if (NULL != f)
+	{
+		gOutValue[gOutValues++].f = val;
+		f->count++;
+	}
+}
+
+void outStr(const char* key, const char* val)
+{
+	OutFieldType* f;
+	int len = strlen(val);
+
+	if ( (gOutFormat == OUT_TEXT) || (NULL != gOutArray)
+		|| (gOutStrLen + len > OUT_STR_MAX))
+	{
+		return;
+	}
+	f = outField(key, 's');
+	if (NULL != f)
+	{
+		f->first = gOutStrLen;
+		f->count = len;
+		memcpy(&gOutStr[gOutStrLen], val, len);
+		gOutStrLen += len;
+	}
+}
+
+// The values added up to outArrayEnd() make one field
+void outArrayBegin(const char* key)
+{
+	if (gOutFormat == OUT_TEXT)
+	{
+		return;
+	}
+	gOutArray = NULL;
+	gOutArray = outField(key, 'i');
+	if (NULL != gOutArray)
+	{
+		gOutArray->array = 1;
+	}
+}
+
+void outArrayEnd(void)
+{
+	gOutArray = NULL;
+}
+
+static void outJsonStr(const char* str, int len)
+{
+	int i;
+
+	fputc('"', gOut);
+	for (i = 0; i < len; i++)
+	{
+		if ( (str[i] == '"') || (str[i] == '\\'))
+		{
+			fprintf(gOut, "\\%c", str[i]);
+		}
+		else if ( (unsigned char)str[i] < 0x20)
+		{
+			fprintf(gOut, "\\u%04x", str[i]);
+		}
+		else
+		{
+			fputc(str[i], gOut);
+		}
+	}
+	fputc('"', gOut);
+}
+
+// A float that is not finite has no number form: none is written instead
+static void outValue(const OutFieldType* f, int i, const char* none)
+{
+	if ( (f->type == 'f') && !isfinite(gOutValue[f->first + i].f))
+	{
+		fputs(none, gOut);
+	}
+	else if (f->type == 'f')
+	{
+		fprintf(gOut, "%.15g", gOutValue[f->first + i].f);
+	}
+	else
+	{
+		fprintf(gOut, "%lld", (long long)gOutValue[f->first + i].i);
+	}
+}
+
+static void outJson(int status)
+{
+	const OutFieldType* f;
+	int i;
+	int j;
+
+	fprintf(gOut, "{\"cmd\":");
+	outJsonStr(gOutCmd, strlen(gOutCmd));
+	if (gOutStack >= 0)
+	{
+		fprintf(gOut, ",\"bus\":%d,\"stack\":%d", gOutBus, gOutStack);
+	}
+	fprintf(gOut, ",\"status\":%d", status);
+	for (i = 0; i < gOutFields; i++)
+	{
+		f = &gOutField[i];
+		fputc(',', gOut);
+		outJsonStr(f->key, strlen(f->key));
+		fputc(':', gOut);
+		if (f->type == 's')
+		{
+			outJsonStr(&gOutStr[f->first], f->count);
+			continue;
+		}
+		if (!f->array)
+		{
+			outValue(f, 0, "null");
+			continue;
+		}
+		fputc('[', gOut);
+		for (j = 0; j < f->count; j++)
+		{
+			if (j)
+			{
+				fputc(',', gOut);
+			}
+			outValue(f, j, "null");
+		}
+		fputc(']', gOut);
+	}
+	fprintf(gOut, "}\n");
+}
+
+// Quoted only when needed
+static void outCsvStr(FILE* out, const char* str, int len)
+{
+	int i;
+
+	if ( (memchr(str, ',', len) == NULL) && (memchr(str, '"', len) == NULL)
+		&& (memchr(str, '\n', len) == NULL))
+	{
+		fwrite(str, 1, len, out);
+		return;
+	}
+	fputc('"', out);
+	for (i = 0; i < len; i++)
+	{
+		if (str[i] == '"')
+		{
+			fputc('"', out);
+		}
+		fputc(str[i], out);
+	}
+	fputc('"', out);
+}
+
+static void outCsv(int status)
+{
+	char header[OUT_LINE_MAX];
+	const OutFieldType* f;
+	FILE* h;
+	int i;
+	int j;
+
+	h = fmemopen(header, sizeof(header), "w");
+	if (NULL == h)
+	{
+		return;
+	}
+	fprintf(h, gOutStack >= 0 ? "cmd,bus,stack,status" : "cmd,status");
+	for (i = 0; i < gOutFields; i++)
+	{
+		f = &gOutField[i];
+		if ( (f->type == 's') || !f->array)
+		{
+			fprintf(h, ",%s", f->key);
+			continue;
+		}
+		for (j = 0; j < f->count; j++)
+		{
+			fprintf(h, ",%s%d", f->key, j + 1);
+		}
+	}
+	fputc(0, h);
+	fclose(h);
+	header[sizeof(header) - 1] = 0;
+	if (strcmp(header, gOutHeader) != 0)
+	{
+		fprintf(gOut, "%s\n", header);
+		strcpy(gOutHeader, header);
+	}
+	outCsvStr(gOut, gOutCmd, strlen(gOutCmd));
+	if (gOutStack >= 0)
+	{
+		fprintf(gOut, ",%d,%d", gOutBus, gOutStack);
+	}
+	fprintf(gOut, ",%d", status);
+	for (i = 0; i < gOutFields; i++)
+	{
+		f = &gOutField[i];
+		if (f->type == 's')
+		{
+			fputc(',', gOut);
+			outCsvStr(gOut, &gOutStr[f->first], f->count);
+			continue;
+		}
+		for (j = 0; j < f->count; j++)
+		{
+			fputc(',', gOut);
+			outValue(f, j, "");
+		}
+	}
+	fputc('\n', gOut);
+}
+
+static int outBinPut(uint8_t* buff, int pos, const void* data, int size)
+{
+	if (pos + size > OUT_BIN_MAX)
+	{
+		return OUT_BIN_MAX + 1;
+	}
+	memcpy(&buff[pos], data, size);
+	return pos + size;
+}
+
+static void outBin(int status)
+{
+	static uint8_t buff[OUT_BIN_MAX];
+	OutBinHeadType head;
+	OutBinFieldType field;
+	const OutFieldType* f;
+	int pos;
+	int i;
+
+	memset(&head, 0, sizeof(head));
+	head.magic = OUT_BIN_MAGIC;
+	head.status = status;
+	head.bus = gOutStack >= 0 ? gOutBus : OUT_NO_BOARD;
+	head.stack = gOutStack >= 0 ? gOutStack : OUT_NO_BOARD;
+	head.fields = gOutFields;
+	head.cmdLen = strlen(gOutCmd);
+	pos = sizeof(head);
+	pos = outBinPut(buff, pos, gOutCmd, head.cmdLen);
+	for (i = 0; (i < gOutFields) && (pos <= OUT_BIN_MAX); i++)
+	{
+		f = &gOutField[i];
+		field.type = f->type;
+		field.keyLen = strlen(f->key);
+		field.count = f->count;
+		pos = outBinPut(buff, pos, &field, sizeof(field));
+		pos = outBinPut(buff, pos, f->key, field.keyLen);
+		if (f->type == 's')
+		{
+			pos = outBinPut(buff, pos, &gOutStr[f->first], f->count);
+		}
+		else
+		{
+			pos = outBinPut(buff, pos, &gOutValue[f->first],
+				f->count * sizeof(OutValueType));
+		}
+	}
+	if (pos > OUT_BIN_MAX)
+	{
+		fprintf(stderr, "Record of %s too large\n", gOutCmd);
+		return;
+	}
+	head.size = pos;
+	memcpy(buff, &head, sizeof(head));
+	fwrite(buff, 1, pos, gOut);
+}
+
+// Write the current record and start a new one for the same command
+void outRecord(int status)
+{
+	if (gOutFormat == OUT_TEXT)
+	{
+		return;
+	}
+	gOutArray = NULL;
+	switch (gOutFormat)
+	{
+	case OUT_JSON:
+		outJson(status);
+		break;
+	case OUT_CSV:
+		outCsv(status);
+		break;
+	default:
+		outBin(status);
+		break;
+	}
+	fflush(gOut);
+	gOutEmitted = 1;
+	outReset();
+}
+
+/*
+ * Close the record of the command. Streaming commands emit their own
+ * records, the last one is written only if it carries something.
+ */
+void outEnd(int status)
+{
+	if ( (gOutFields > 0) || !gOutEmitted || (status != OK))
+	{
+		outRecord(status);
+	}
+}
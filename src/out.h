@@ -0,0 +1,67 @@
+#ifndef OUT_H
+#define OUT_H
+
+#include <stdint.h>
+
+typedef enum
+{
+	OUT_TEXT,
+	OUT_JSON,
+	OUT_CSV,
+	OUT_BIN,
+} OutFormatType;
+
+/*
+ * Result records of the commands. The dispatcher opens a record per
+ * command (name, board and status), the handlers add named fields. Text
+ * goes through outText() and is printed only in the text format; in the
+ * other formats the records are the only thing written on stdout, any
+ * other message is sent to stderr.
+ *
+ * json: one object per line, arrays for the multi-channel fields, null
+ *       for a float that is not finite.
+ * csv:  a header line when the columns change, then one line per record,
+ *       array fields spread over <key>1..<key>n columns, no bus and stack
+ *       columns for the commands without a board id, an empty column for
+ *       a float that is not finite.
+ * bin:  one packed record per command, host byte order (little endian on
+ *       the Raspberry Pi):
+ *       OutBinHeadType, the command name, then for every field an
+ *       OutBinFieldType, the key and count values: int64 for 'i', double
+ *       for 'f', count characters for 's'.
+ */
+#define OUT_BIN_MAGIC	0x5231 // "1R"
+#define OUT_NO_BOARD	0xff
+
+typedef struct __attribute__((packed))
+{
+	uint16_t magic;
+	uint16_t size; // whole record
+	int8_t status; // 0 = OK, the command error code else
+	uint8_t bus; // OUT_NO_BOARD for the commands without a board id
+	uint8_t stack;
+	uint8_t fields;
+	uint8_t cmdLen;
+} OutBinHeadType;
+
+typedef struct __attribute__((packed))
+{
+	uint8_t type; // 'i', 'f' or 's'
+	uint8_t keyLen;
+	uint16_t count;
+} OutBinFieldType;
+
+int outFormatSet(const char* name);
+OutFormatType outFormat(void);
+int outText(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+void outBegin(const char* cmd, int bus, int stack);
+void outInt(const char* key, int64_t val);
+void outFloat(const char* key, double val);
+void outStr(const char* key, const char* val);
+void outArrayBegin(const char* key);
+void outArrayEnd(void);
+void outRecord(int status);
+void outEnd(int status);
+
+#endif /* OUT_H */
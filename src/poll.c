@@ -0,0 +1,206 @@
+/*
+ * poll.c:
+ *	Polling engine for all the boards of all the buses. A cycle reads the
+ *	due groups of every stack level of a bus in one frame read, the buses
+ *	run in parallel.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "board.h"
+#include "comm.h"
+#include "data.h"
+#include "poll.h"
+
+typedef struct
+{
+	PollType* poll;
+	PollSetupType setup;
+	void* arg;
+	uint64_t nowNs;
+} PollWorkType;
+
+static uint64_t pollNowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static PollBusType* pollBusFind(PollType* p, int bus)
+{
+	int i;
+
+	for (i = 0; i < p->count; i++)
+	{
+		if (p->bus[i].bus == bus)
+		{
+			return &p->bus[i];
+		}
+	}
+	return NULL;
+}
+
+static void pollBusOpen(int bus, void* arg)
+{
+	PollWorkType* w = arg;
+	PollBusType* b = pollBusFind(w->poll, bus);
+	int stack;
+
+	for (stack = 0; stack < POLL_STACK_MAX; stack++)
+	{
+		b->dev[stack] = -1;
+		memset(&b->sched[stack], 0, sizeof(SchedType));
+		if (boardCheckBus(bus, stack) != OK)
+		{
+			continue;
+		}
+		b->dev[stack] = i2cSetupBus(bus, (stack + INPUT16_HW_I2C_BASE_ADD) ^ 0x07);
+		w->setup(&b->sched[stack], bus, stack, w->arg);
+	}
+}
+
+// Discover the boards of every bus, returns the number of boards found
+int pollOpen(PollType* p, const int* bus, int count, PollSetupType setup,
+	void* arg)
+{
+	PollWorkType w = { p, setup, arg, 0 };
+	int boards = 0;
+	int i;
+	int stack;
+
+	if ( (NULL == p) || (NULL == setup) || (count <= 0) || (count > I2C_BUS_MAX))
+	{
+		return ERROR;
+	}
+	memset(p, 0, sizeof(PollType));
+	p->count = count;
+	for (i = 0; i < count; i++)
+	{
+		p->bus[i].bus = bus[i];
+	}
+	i2cBusWorkersRun(bus, count, pollBusOpen, &w);
+	for (i = 0; i < count; i++)
+	{
+		for (stack = 0; stack < POLL_STACK_MAX; stack++)
+		{
+			boards += p->bus[i].dev[stack] > 0;
+		}
+	}
+	return boards;
+}
+
+static void pollBusCycle(int bus, void* arg)
+{
+	PollWorkType* w = arg;
+	PollBusType* b = pollBusFind(w->poll, bus);
+	I2cReadSegType seg[POLL_STACK_MAX * SCHED_GROUP_MAX];
+	int first[POLL_STACK_MAX];
+	int last[POLL_STACK_MAX];
+	int count = 0;
+	int stack;
+	int i;
+
+	b->startNs = pollNowNs();
+	for (stack = 0; stack < POLL_STACK_MAX; stack++)
+	{
+		first[stack] = last[stack] = count;
+		b->done[stack] = 0;
+		if (b->dev[stack] <= 0)
+		{
+			continue;
+		}
+		count += schedPlan(&b->sched[stack], w->nowNs, &seg[count]);
+		last[stack] = count;
+		for (i = first[stack]; i < count; i++)
+		{
+			seg[i].dev = b->dev[stack];
+		}
+	}
+	if (count > 0)
+	{
+		i2cMem8ReadFrame(seg, count);
+	}
+	b->failed = 0;
+	for (stack = 0; stack < POLL_STACK_MAX; stack++)
+	{
+		if (b->dev[stack] <= 0)
+		{
+			continue;
+		}
+		if (OK != schedCommit(&b->sched[stack], w->nowNs, &seg[first[stack]],
+			last[stack] - first[stack], &b->done[stack]))
+		{
+			b->failed |= 1 << stack;
+		}
+	}
+	b->endNs = pollNowNs();
+}
+
+/*
+ * Start the workers of the cycles, one per bus kept for the life of the
+ * poller. Call it after the real time setup, the workers inherit it.
+ */
+int pollStart(PollType* p)
+{
+	int bus[I2C_BUS_MAX];
+	int i;
+
+	for (i = 0; i < p->count; i++)
+	{
+		bus[i] = p->bus[i].bus;
+	}
+	if (i2cBusWorkersStart(bus, p->count, pollBusCycle) != 0)
+	{
+		printf("Fail to start the bus workers\n");
+		return ERROR;
+	}
+	return OK;
+}
+
+/*
+ * One cycle: the due groups of all the boards of a bus go in one frame
+ * read, every bus in its own worker.
+ */
+int pollCycle(PollType* p, uint64_t nowNs)
+{
+	PollWorkType w = { p, NULL, NULL, nowNs };
+
+	p->cycle++;
+	return i2cBusWorkersCycle(&w) == 0 ? OK : ERROR;
+}
+
+void pollClose(PollType* p)
+{
+	(void)p;
+	i2cBusWorkersStop();
+}
+
+uint64_t pollNext(const PollType* p)
+{
+	uint64_t next = UINT64_MAX;
+	uint64_t t;
+	int i;
+	int stack;
+
+	for (i = 0; i < p->count; i++)
+	{
+		for (stack = 0; stack < POLL_STACK_MAX; stack++)
+		{
+			if (p->bus[i].dev[stack] <= 0)
+			{
+				continue;
+			}
+			t = schedNext(&p->bus[i].sched[stack]);
+			if (t < next)
+			{
+				next = t;
+			}
+		}
+	}
+	return next;
+}
@@ -0,0 +1,40 @@
+#ifndef POLL_H
+#define POLL_H
+
+#include <stdint.h>
+#include "comm.h"
+#include "sched.h"
+
+#define POLL_STACK_MAX	8
+
+// Boards of one bus, their schedules and the result of the last cycle
+typedef struct
+{
+	int bus;
+	int dev[POLL_STACK_MAX]; // by stack level, -1 if no board
+	SchedType sched[POLL_STACK_MAX];
+	uint32_t done[POLL_STACK_MAX]; // groups refreshed in the last cycle
+	uint32_t failed; // stack levels with a failed range in the last cycle
+	uint64_t startNs;
+	uint64_t endNs;
+} PollBusType;
+
+// Frame of all the boards of all the buses, rebuilt by every cycle
+typedef struct
+{
+	uint64_t cycle;
+	int count;
+	PollBusType bus[I2C_BUS_MAX];
+} PollType;
+
+// Registers the groups to read on one board
+typedef void (*PollSetupType)(SchedType* s, int bus, int stack, void* arg);
+
+int pollOpen(PollType* p, const int* bus, int count, PollSetupType setup,
+	void* arg);
+int pollStart(PollType* p);
+int pollCycle(PollType* p, uint64_t nowNs);
+void pollClose(PollType* p);
+uint64_t pollNext(const PollType* p);
+
+#endif /* POLL_H */
@@ -6,6 +6,7 @@
 #include "cli.h"
 #include "comm.h"
 #include "data.h"
+#include "out.h"
 
 typedef struct __attribute__((packed))
 {
@@ -49,15 +50,20 @@ int doCfg485Read(int argc, char *argv[])
 	
 	if (settings.mbType == 0)
 	{
-		printf(
+		outText(
 			"RS485 port disconnected from local procesoor and can be used with Raspberry Pi Serial port\n");
 	}
 	else
 	{
-		printf("Modbus RTU slave enabled,Id: %d, BR: %d, stopB: %d, parity: %d\n",
+		outText("Modbus RTU slave enabled,Id: %d, BR: %d, stopB: %d, parity: %d\n",
 			(int)settings.add, (int)settings.mbBaud, (int)settings.mbStopB,
 			(int)settings.mbParity);
 	}
+	outInt("modbus", settings.mbType);
+	outInt("id", settings.add);
+	outInt("baud", settings.mbBaud);
+	outInt("stop_bits", settings.mbStopB);
+	outInt("parity", settings.mbParity);
 	return OK;
 }
 
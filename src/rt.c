@@ -0,0 +1,117 @@
+/*
+ * rt.c:
+ *	Real-time scheduling, CPU pinning and memory locking of a sampling
+ *	process.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "data.h"
+#include "rt.h"
+
+// "2" or "2,3": CPU numbers in the affinity mask, ERROR on a bad list
+int rtCpusParse(const char* list, unsigned long* cpus)
+{
+	char* end;
+	long cpu;
+
+	*cpus = 0;
+	while (*list)
+	{
+		cpu = strtol(list, &end, 10);
+		if ( (end == list) || (cpu < 0) || (cpu >= (long)sizeof(*cpus) * 8)
+			|| ( (*end != 0) && (*end != ',')))
+		{
+			return ERROR;
+		}
+		*cpus |= 1UL << cpu;
+		list = *end ? end + 1 : end;
+	}
+	return *cpus ? OK : ERROR;
+}
+
+// Touch every page of the buffer so no fault happens in the sampling loop
+void rtPrefault(void* buff, size_t size)
+{
+	volatile uint8_t* p = buff;
+	long page = sysconf(_SC_PAGESIZE);
+	size_t i;
+
+	for (i = 0; i < size; i += page)
+	{
+		p[i] = p[i];
+	}
+}
+
+// The stack the sampling loop will use, faulted in once
+static void __attribute__((noinline)) rtStackPrefault(void)
+{
+	uint8_t stack[RT_STACK_PREFAULT];
+
+	memset(stack, 0, sizeof(stack));
+	__asm__ __volatile__("" : : "r"(stack) : "memory");
+}
+
+int rtSetup(const RtType* rt)
+{
+	struct sched_param param;
+	cpu_set_t set;
+	int cpu;
+
+	if ( (NULL == rt) || ( (rt->prio == 0) && (rt->cpus == 0)))
+	{
+		return OK;
+	}
+	// the caller's own rights only: a setuid run would hand any user the CPU
+	if ( (getuid() != geteuid()) || (getgid() != getegid()))
+	{
+		printf("Real-time and CPU pinning are refused in a setuid run\n");
+		return ERROR;
+	}
+	if (rt->cpus != 0)
+	{
+		CPU_ZERO(&set);
+		for (cpu = 0; cpu < (int)sizeof(rt->cpus) * 8; cpu++)
+		{
+			if (rt->cpus & (1UL << cpu))
+			{
+				CPU_SET(cpu, &set);
+			}
+		}
+		if (sched_setaffinity(0, sizeof(set), &set) != 0)
+		{
+			printf("Fail to set the CPU affinity: %s\n", strerror(errno));
+			return ERROR;
+		}
+	}
+	if (rt->prio == 0)
+	{
+		return OK;
+	}
+	// freed memory stays mapped and locked, no mmap for big blocks
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		printf("Fail to lock the memory: %s\n", strerror(errno));
+		return ERROR;
+	}
+	rtStackPrefault();
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = rt->prio;
+	if (sched_setscheduler(0, SCHED_FIFO, &param) != 0)
+	{
+		printf("Fail to set the SCHED_FIFO priority %d: %s\n", rt->prio,
+			strerror(errno));
+		return ERROR;
+	}
+	return OK;
+}
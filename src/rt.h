@@ -0,0 +1,24 @@
+#ifndef RT_H
+#define RT_H
+
+#include <stddef.h>
+
+#define RT_PRIO_DEFAULT	50
+#define RT_STACK_PREFAULT	(256 * 1024)
+
+/*
+ * Real-time setup of a sampling process: SCHED_FIFO priority (0 keeps
+ * the normal scheduling), CPU affinity mask (0 = any CPU) and all the
+ * memory locked and prefaulted. The bus workers inherit all of it.
+ */
+typedef struct
+{
+	int prio;
+	unsigned long cpus; // bit n = CPU n
+} RtType;
+
+int rtCpusParse(const char* list, unsigned long* cpus);
+int rtSetup(const RtType* rt);
+void rtPrefault(void* buff, size_t size);
+
+#endif /* RT_H */
@@ -0,0 +1,335 @@
+/*
+ * sched.c:
+ *	Poll scheduler: every register group has its own period, the groups
+ *	due at a tick are merged in as few ranges as possible and read in one
+ *	submission.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "comm.h"
+#include "data.h"
+#include "sched.h"
+
+int schedGroupAdd(SchedType* s, const char* name, int add, int size,
+	uint32_t periodUs)
+{
+	SchedGroupType* g;
+
+	if ( (NULL == s) || (s->count >= SCHED_GROUP_MAX) || (add < 0) || (size <= 0)
+		|| (add + size > SLAVE_BUFF_SIZE) || (periodUs == 0))
+	{
+		return ERROR;
+	}
+	g = &s->group[s->count++];
+	memset(g, 0, sizeof(*g));
+	g->name = name;
+	g->add = add;
+	g->size = size;
+	g->periodUs = periodUs;
+	g->minUs = periodUs;
+	g->maxUs = periodUs;
+	return OK;
+}
+
+SchedGroupType* schedGroupFind(SchedType* s, const char* name)
+{
+	int i;
+
+	for (i = 0; (NULL != s) && (i < s->count); i++)
+	{
+		if (strcmp(s->group[i].name, name) == 0)
+		{
+			return &s->group[i];
+		}
+	}
+	return NULL;
+}
+
+// Let the period move between period / factor and period * factor
+void schedAutoTune(SchedGroupType* g, uint32_t factor)
+{
+	if ( (NULL == g) || (factor == 0))
+	{
+		return;
+	}
+	g->minUs = g->periodUs / factor;
+	g->maxUs = g->periodUs * factor;
+}
+
+static void schedTune(SchedGroupType* g, int changed)
+{
+	uint32_t period = g->periodUs;
+
+	if (g->minUs >= g->maxUs)
+	{
+		return;
+	}
+	period = changed ? period / 2 : period + period / 8 + 1;
+	if (period < g->minUs)
+	{
+		period = g->minUs;
+	}
+	if (period > g->maxUs)
+	{
+		period = g->maxUs;
+	}
+	g->periodUs = period;
+}
+
+static void schedStat(SchedGroupType* g)
+{
+	SchedStatType* st = &g->stat;
+	uint64_t period = g->periodUs * 1000ULL;
+	uint64_t ival;
+	uint64_t jitter;
+	double delta;
+
+	if (st->lastNs != 0)
+	{
+		ival = g->reqNs - st->lastNs;
+		// Welford running mean and variance of the interval
+		st->count++;
+		delta = ival - st->mean;
+		st->mean += delta / st->count;
+		st->m2 += delta * (ival - st->mean);
+		if ( (st->minNs == 0) || (ival < st->minNs))
+		{
+			st->minNs = ival;
+		}
+		if (ival > st->maxNs)
+		{
+			st->maxNs = ival;
+		}
+		jitter = ival > period ? ival - period : period - ival;
+		if (jitter > st->jitterMaxNs)
+		{
+			st->jitterMaxNs = jitter;
+		}
+	}
+	st->lastNs = g->reqNs;
+}
+
+/*
+ * Next due time on the grid of the period, not from the read time: the
+ * wake up delays do not add up. A read late by a period or more lost
+ * samples, they are counted as misses and the grid moves past them.
+ */
+static void schedDue(SchedGroupType* g, uint64_t nowNs)
+{
+	uint64_t period = g->periodUs * 1000ULL;
+	uint64_t late;
+	uint64_t lost;
+
+	if (g->nextNs == 0)
+	{
+		g->nextNs = nowNs + period;
+		return;
+	}
+	late = nowNs > g->nextNs ? nowNs - g->nextNs : 0;
+	if (late > g->stat.lateMaxNs)
+	{
+		g->stat.lateMaxNs = late;
+	}
+	lost = late / period;
+	g->stat.misses += lost;
+	g->nextNs += (lost + 1) * period;
+}
+
+// Take the sampling time of the range holding the group
+static void schedSampleTime(SchedGroupType* g, const I2cReadSegType* seg,
+	int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if ( (g->add >= seg[i].add) && (g->add < seg[i].add + seg[i].size))
+		{
+			g->reqNs = seg[i].reqNs;
+			g->doneNs = seg[i].doneNs;
+			schedStat(g);
+			return;
+		}
+	}
+}
+
+/*
+ * Ranges to read for the groups due at nowNs: the due ranges closer than
+ * SCHED_GAP_MAX bytes are merged, seg gets at most SCHED_GROUP_MAX
+ * ranges sorted by address, the groups past them are carried over to the
+ * next cycle. Returns the number of ranges.
+ */
+int schedPlan(SchedType* s, uint64_t nowNs, I2cReadSegType* seg)
+{
+	uint8_t due[SLAVE_BUFF_SIZE];
+	int count = 0;
+	int add;
+	int end;
+	int i;
+	int j;
+
+	memset(due, 0, sizeof(due));
+	s->plan = 0;
+	for (i = 0; i < s->count; i++)
+	{
+		if (s->group[i].nextNs <= nowNs)
+		{
+			s->plan |= 1 << i;
+			memset(&due[s->group[i].add], 1, s->group[i].size);
+		}
+	}
+	// walk the map once: ranges come out sorted and merged
+	for (add = 0; (add < SLAVE_BUFF_SIZE) && (count < SCHED_GROUP_MAX); add = end)
+	{
+		if (!due[add])
+		{
+			end = add + 1;
+			continue;
+		}
+		end = add;
+		while (1)
+		{
+			while ( (end < SLAVE_BUFF_SIZE) && due[end])
+			{
+				end++;
+			}
+			for (j = end; (j < SLAVE_BUFF_SIZE) && (j - end < SCHED_GAP_MAX) && !due[j];
+				j++)
+				;
+			if ( (j >= SLAVE_BUFF_SIZE) || !due[j])
+			{
+				break;
+			}
+			end = j;
+		}
+		memset(&seg[count], 0, sizeof(seg[count]));
+		seg[count].add = add;
+		seg[count].buff = &s->mem[add];
+		seg[count].size = end - add;
+		count++;
+	}
+	// a group left out of the ranges stays due and is read next cycle
+	memset(due, 0, sizeof(due));
+	for (i = 0; i < count; i++)
+	{
+		memset(&due[seg[i].add], 1, seg[i].size);
+	}
+	for (i = 0; i < s->count; i++)
+	{
+		if ( (s->plan & (1 << i))
+			&& (memchr(&due[s->group[i].add], 0, s->group[i].size) != NULL))
+		{
+			s->plan &= ~(1 << i);
+		}
+	}
+	memcpy(s->prev, s->mem, sizeof(s->prev));
+	return count;
+}
+
+/*
+ * Account the ranges of the last plan once read: done gets a bit per
+ * refreshed group. Returns ERROR if a range failed.
+ */
+int schedCommit(SchedType* s, uint64_t nowNs, const I2cReadSegType* seg,
+	int count, uint32_t* done)
+{
+	uint8_t fail[SLAVE_BUFF_SIZE];
+	uint32_t mask = s->plan;
+	int ret = OK;
+	int i;
+
+	memset(fail, 0, sizeof(fail));
+	for (i = 0; i < count; i++)
+	{
+		if (seg[i].status != 0)
+		{
+			// keep the last good values
+			memcpy(&s->mem[seg[i].add], &s->prev[seg[i].add], seg[i].size);
+			memset(&fail[seg[i].add], 1, seg[i].size);
+			ret = ERROR;
+		}
+	}
+	for (i = 0; i < s->count; i++)
+	{
+		SchedGroupType* g = &s->group[i];
+
+		if ( (mask & (1 << i)) == 0)
+		{
+			continue;
+		}
+		schedDue(g, nowNs);
+		if (fail[g->add])
+		{
+			mask &= ~(1 << i);
+			continue;
+		}
+		g->timeNs = nowNs;
+		g->samples++;
+		schedSampleTime(g, seg, count);
+		if (memcmp(&s->prev[g->add], &s->mem[g->add], g->size) != 0)
+		{
+			g->changes++;
+			schedTune(g, 1);
+		}
+		else
+		{
+			schedTune(g, 0);
+		}
+	}
+	s->plan = 0;
+	if (NULL != done)
+	{
+		*done = mask;
+	}
+	return ret;
+}
+
+// Plan, read and commit the due groups of one board
+int schedRun(int dev, SchedType* s, uint64_t nowNs, uint32_t* done)
+{
+	I2cReadSegType seg[SCHED_GROUP_MAX];
+	int count = schedPlan(s, nowNs, seg);
+
+	if (count > 0)
+	{
+		i2cMem8ReadMulti(dev, seg, count);
+	}
+	return schedCommit(s, nowNs, seg, count, done);
+}
+
+uint64_t schedNext(const SchedType* s)
+{
+	uint64_t next = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < s->count; i++)
+	{
+		if (s->group[i].nextNs < next)
+		{
+			next = s->group[i].nextNs;
+		}
+	}
+	return next;
+}
+
+// Standard deviation of the sampling interval, ns
+double schedStatJitter(const SchedStatType* st)
+{
+	return st->count > 1 ? sqrt(st->m2 / (st->count - 1)) : 0;
+}
+
+void schedStatPrint(FILE* f, const char* prefix, const SchedGroupType* g)
+{
+	const SchedStatType* st = &g->stat;
+
+	fprintf(f, "%s%-9s %8llu samples, period %u us, interval avg %.1f sd %.1f"
+		" min %.1f max %.1f us, jitter max %.1f us, late max %.1f us, %llu missed\n",
+		prefix, g->name, (unsigned long long)g->samples, g->periodUs,
+		st->mean / 1000, schedStatJitter(st) / 1000, st->minNs / 1000.0,
+		st->maxNs / 1000.0, st->jitterMaxNs / 1000.0, st->lateMaxNs / 1000.0,
+		(unsigned long long)st->misses);
+}
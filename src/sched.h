@@ -0,0 +1,70 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "comm.h"
+#include "data.h"
+
+#define SCHED_GROUP_MAX	8
+#define SCHED_GAP_MAX	4 // bytes read over to merge two ranges
+
+// Sampling interval of a group, from the request times of its reads
+typedef struct
+{
+	uint64_t count;
+	uint64_t lastNs;
+	double mean; // ns
+	double m2; // sum of squared deviations from the mean
+	uint64_t minNs;
+	uint64_t maxNs;
+	uint64_t jitterMaxNs; // largest distance from the set period
+	uint64_t lateMaxNs; // largest delay of a read after its due time
+	uint64_t misses; // periods lost: read a full period or more late
+} SchedStatType;
+
+/*
+ * Register group read at its own period. With minUs < maxUs the period
+ * follows the data: halved when the group changed, stretched by 1/8 when
+ * it did not.
+ */
+typedef struct
+{
+	const char* name;
+	int add;
+	int size;
+	uint32_t periodUs;
+	uint32_t minUs;
+	uint32_t maxUs;
+	uint64_t nextNs; // next due time
+	uint64_t timeNs; // last refresh
+	uint64_t reqNs; // CLOCK_MONOTONIC_RAW request and completion of it
+	uint64_t doneNs;
+	uint32_t samples;
+	uint32_t changes;
+	SchedStatType stat;
+} SchedGroupType;
+
+// Read schedule of one board, the groups are refreshed in mem[]
+typedef struct
+{
+	SchedGroupType group[SCHED_GROUP_MAX];
+	int count;
+	uint32_t plan; // groups of the pending plan
+	uint8_t mem[SLAVE_BUFF_SIZE];
+	uint8_t prev[SLAVE_BUFF_SIZE]; // mem before the pending plan
+} SchedType;
+
+int schedGroupAdd(SchedType* s, const char* name, int add, int size,
+	uint32_t periodUs);
+SchedGroupType* schedGroupFind(SchedType* s, const char* name);
+void schedAutoTune(SchedGroupType* g, uint32_t factor);
+int schedPlan(SchedType* s, uint64_t nowNs, I2cReadSegType* seg);
+int schedCommit(SchedType* s, uint64_t nowNs, const I2cReadSegType* seg,
+	int count, uint32_t* done);
+int schedRun(int dev, SchedType* s, uint64_t nowNs, uint32_t* done);
+uint64_t schedNext(const SchedType* s);
+double schedStatJitter(const SchedStatType* st);
+void schedStatPrint(FILE* f, const char* prefix, const SchedGroupType* g);
+
+#endif /* SCHED_H */
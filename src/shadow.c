@@ -0,0 +1,229 @@
+/*
+ * shadow.c:
+ *	Memory image of the card register map. Once enabled on a board
+ *	handle, i2cMem8Read() serves the refreshed ranges from memory so all
+ *	the getters can share one bulk refresh per cycle.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "comm.h"
+#include "data.h"
+#include "out.h"
+#include "shadow.h"
+
+typedef struct
+{
+	uint8_t mem[SLAVE_BUFF_SIZE];
+	uint8_t valid[SLAVE_BUFF_SIZE];
+} ShadowType;
+
+static ShadowType* gShadow[I2C_DEV_MAX];
+
+static ShadowType* shadowGet(int dev)
+{
+	if ( (dev < 1) || (dev > I2C_DEV_MAX))
+	{
+		return NULL;
+	}
+	return gShadow[dev - 1];
+}
+
+int shadowEnable(int dev)
+{
+	if ( (dev < 1) || (dev > I2C_DEV_MAX))
+	{
+		return ERROR;
+	}
+	if (NULL == gShadow[dev - 1])
+	{
+		gShadow[dev - 1] = calloc(1, sizeof(ShadowType));
+		if (NULL == gShadow[dev - 1])
+		{
+			return ERROR;
+		}
+	}
+	return OK;
+}
+
+void shadowDisable(int dev)
+{
+	if ( (dev < 1) || (dev > I2C_DEV_MAX))
+	{
+		return;
+	}
+	free(gShadow[dev - 1]);
+	gShadow[dev - 1] = NULL;
+}
+
+// Read [add, add + size) from the card, the transport splits it in
+// 32 bytes bursts sent in one transfer
+int shadowRefresh(int dev, int add, int size)
+{
+	ShadowType* sh = shadowGet(dev);
+	I2cReadSegType seg;
+
+	if (NULL == sh)
+	{
+		return ERROR;
+	}
+	if ( (add < 0) || (size <= 0) || (add + size > SLAVE_BUFF_SIZE))
+	{
+		return ERROR;
+	}
+	seg.add = add;
+	seg.buff = &sh->mem[add];
+	seg.size = size;
+	i2cMem8ReadMulti(dev, &seg, 1);
+	memset(&sh->valid[add], seg.status == 0, size);
+	return seg.status == 0 ? OK : ERROR;
+}
+
+/*
+ * The same range of several boards of one bus in one frame. A board whose
+ * read failed keeps an invalid range, devices without a shadow are skipped.
+ */
+int shadowRefreshFrame(const int* dev, int count, int add, int size)
+{
+	I2cReadSegType seg[I2C_DEV_MAX];
+	ShadowType* sh;
+	int ret = OK;
+	int n = 0;
+	int i;
+
+	if ( (count <= 0) || (count > I2C_DEV_MAX) || (add < 0) || (size <= 0)
+		|| (add + size > SLAVE_BUFF_SIZE))
+	{
+		return ERROR;
+	}
+	for (i = 0; i < count; i++)
+	{
+		sh = shadowGet(dev[i]);
+		if (NULL == sh)
+		{
+			continue;
+		}
+		seg[n].dev = dev[i];
+		seg[n].add = add;
+		seg[n].buff = &sh->mem[add];
+		seg[n].size = size;
+		n++;
+	}
+	if (n == 0)
+	{
+		return ERROR;
+	}
+	i2cMem8ReadFrame(seg, n);
+	for (i = 0; i < n; i++)
+	{
+		sh = shadowGet(seg[i].dev);
+		memset(&sh->valid[add], seg[i].status == 0, size);
+		if (seg[i].status != 0)
+		{
+			ret = ERROR;
+		}
+	}
+	return ret;
+}
+
+// OK only if the whole range is in the image
+int shadowRead(int dev, int add, uint8_t* buff, int size)
+{
+	ShadowType* sh = shadowGet(dev);
+	int i;
+
+	if ( (NULL == sh) || (add < 0) || (size <= 0)
+		|| (add + size > SLAVE_BUFF_SIZE))
+	{
+		return ERROR;
+	}
+	for (i = add; i < add + size; i++)
+	{
+		if (!sh->valid[i])
+		{
+			return ERROR;
+		}
+	}
+	memcpy(buff, &sh->mem[add], size);
+	return OK;
+}
+
+// Writes can have side effects on other registers (counter reset, LED
+// set/clear), so the whole image is dropped until the next refresh
+void shadowInvalidate(int dev)
+{
+	ShadowType* sh = shadowGet(dev);
+
+	if (sh != NULL)
+	{
+		memset(sh->valid, 0, sizeof(sh->valid));
+	}
+}
+
+const CliCmdType CMD_DUMP =
+{
+	"dump",
+	2,
+	&doDump,
+	"  dump             Read the card register map in bulk and display it\n",
+	"  Usage:           "PROGRAM_NAME" <id> dump\n"
+	"  Usage:           "PROGRAM_NAME" <id> dump <address> <size>\n",
+	"  Example:         "PROGRAM_NAME" 0 dump; Display all the registers of Board #0\n"
+};
+int doDump(int argc, char *argv[])
+{
+	int add = 0;
+	int size = SLAVE_BUFF_SIZE;
+	uint8_t buff[SLAVE_BUFF_SIZE];
+	I2cReadSegType seg;
+	int i;
+
+	if (argc != 3 && argc != 5)
+	{
+		return ARG_CNT_ERR;
+	}
+	int dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (argc == 5)
+	{
+		add = (int)strtol(argv[3], NULL, 0);
+		size = (int)strtol(argv[4], NULL, 0);
+		if ( (add < 0) || (size <= 0) || (add + size > SLAVE_BUFF_SIZE))
+		{
+			printf("Register range out of map [0..%d]!\n", SLAVE_BUFF_SIZE - 1);
+			return ARG_RANGE_ERROR;
+		}
+	}
+	// straight from the card: the shadow of the board is left as it is
+	seg.add = add;
+	seg.buff = buff;
+	seg.size = size;
+	i2cMem8ReadMulti(dev, &seg, 1);
+	if (seg.status != 0)
+	{
+		printf("Fail to read!\n");
+		return ERROR;
+	}
+	outInt("address", add);
+	outArrayBegin("data");
+	for (i = 0; i < size; i++)
+	{
+		if (i % 16 == 0)
+		{
+			outText("%02x:", add + i);
+		}
+		outText(" %02x", buff[i]);
+		if ( (i % 16 == 15) || (i == size - 1))
+		{
+			outText("\n");
+		}
+		outInt(NULL, buff[i]);
+	}
+	outArrayEnd();
+	return OK;
+}
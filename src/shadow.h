@@ -0,0 +1,18 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <stdint.h>
+#include "cli.h"
+
+extern const CliCmdType CMD_DUMP;
+
+int shadowEnable(int dev);
+void shadowDisable(int dev);
+int shadowRefresh(int dev, int add, int size);
+int shadowRefreshFrame(const int* dev, int count, int add, int size);
+int shadowRead(int dev, int add, uint8_t* buff, int size);
+void shadowInvalidate(int dev);
+
+int doDump(int argc, char *argv[]);
+
+#endif /* SHADOW_H */
@@ -0,0 +1,532 @@
+/*
+ * sim.c:
+ *	Model of the card firmware register map, attached to the loopback
+ *	bus as the "sim" transport. Inputs are driven by signal generators
+ *	and all edge related registers are computed in closed form from
+ *	the elapsed time, so no edge is lost whatever the polling rate.
+ *
+ *	Generators come from $SM16INPIND_SIM, ';' separated:
+ *	  [<stack>/]<ch>:low|high
+ *	  [<stack>/]<ch>:square:<Hz>[:<duty %>]
+ *	  [<stack>/]<ch>:quad:<Hz>[:<1|-1>]       (ch and ch + 1)
+ *	  [<stack>/]<ch>:burst:<Hz>:<duty %>:<pulses>:<bursts per s>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "comm.h"
+#include "data.h"
+#include "sim.h"
+#include "transport.h"
+
+#define SIM_STACK_MAX	8
+#define SIM_NS	1000000000.0
+
+typedef struct
+{
+	uint8_t mem[I2C_MEM_SIZE];
+	SimGenType gen[OPTO_CH_NO];
+	uint64_t start; // ns, generators time origin
+	uint64_t last; // ns, time of the last update
+	uint32_t count[OPTO_CH_NO];
+	int32_t enc[OPTO_ENC_CH_NO];
+} SimBoardType;
+
+static SimBoardType* gSimBoard[I2C_BUS_MAX][SIM_STACK_MAX];
+
+static uint64_t simNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void simPut16(SimBoardType* b, int add, uint16_t val)
+{
+	memcpy(&b->mem[add], &val, 2);
+}
+
+static void simPut32(SimBoardType* b, int add, uint32_t val)
+{
+	memcpy(&b->mem[add], &val, 4);
+}
+
+static uint16_t simGet16(SimBoardType* b, int add)
+{
+	uint16_t val;
+
+	memcpy(&val, &b->mem[add], 2);
+	return val;
+}
+
+// Pulses of a periodic wave started at or before t, edge at "offset"
+// inside every period
+static int64_t simPeriodEdges(double t, double period, double offset)
+{
+	if (t < offset)
+	{
+		return 0;
+	}
+	return (int64_t)( (t - offset) / period) + 1;
+}
+
+static int64_t simBurstEdges(const SimGenType* g, double t, double offset)
+{
+	double period = 1.0 / g->freq;
+	double burst = 1.0 / g->burstFreq;
+	int64_t n;
+	int64_t in;
+
+	if (t < offset)
+	{
+		return 0;
+	}
+	n = (int64_t)( (t - offset) / burst);
+	in = simPeriodEdges(t - offset - n * burst, period, 0);
+	return n * g->pulses + (in < g->pulses ? in : g->pulses);
+}
+
+// Number of rising (or falling) edges in [0, t], t in seconds
+static int64_t simEdges(const SimGenType* g, double t, int falling,
+	double phase)
+{
+	double offset = 0;
+
+	if (g->freq <= 0)
+	{
+		return 0;
+	}
+	offset = phase / g->freq;
+	if (falling)
+	{
+		offset += g->duty / 100.0 / g->freq;
+	}
+	switch (g->kind)
+	{
+	case SIM_GEN_SQUARE:
+	case SIM_GEN_QUAD:
+		return simPeriodEdges(t, 1.0 / g->freq, offset);
+	case SIM_GEN_BURST:
+		return simBurstEdges(g, t, offset);
+	default:
+		return 0;
+	}
+}
+
+static int simLevel(const SimGenType* g, double t, double phase)
+{
+	double period;
+	double pos;
+
+	switch (g->kind)
+	{
+	case SIM_GEN_HIGH:
+		return 1;
+	case SIM_GEN_SQUARE:
+	case SIM_GEN_QUAD:
+	case SIM_GEN_BURST:
+		if (g->freq <= 0)
+		{
+			return 0;
+		}
+		period = 1.0 / g->freq;
+		t -= phase * period;
+		if (t < 0)
+		{
+			return 0;
+		}
+		if (g->kind == SIM_GEN_BURST)
+		{
+			t -= (int64_t)(t * g->burstFreq) / g->burstFreq;
+			if (t >= g->pulses * period)
+			{
+				return 0;
+			}
+		}
+		pos = t - (int64_t)(t / period) * period;
+		return pos < g->duty / 100.0 * period;
+	default:
+		return 0;
+	}
+}
+
+// Quadrature B input lags A by a quarter period when turning forward
+static double simPhase(SimBoardType* b, int ch)
+{
+	if ( (ch > 0) && (b->gen[ch - 1].kind == SIM_GEN_QUAD)
+		&& (b->gen[ch].kind == SIM_GEN_QUAD) && (ch % 2 == 1))
+	{
+		return b->gen[ch - 1].dir >= 0 ? 0.25 : -0.25;
+	}
+	return 0;
+}
+
+// Bring every time dependent register to "now"
+static void simUpdate(SimBoardType* b)
+{
+	uint64_t now = simNow();
+	double t0 = (b->last - b->start) / SIM_NS;
+	double t1 = (now - b->start) / SIM_NS;
+	uint16_t rising = simGet16(b, I2C_MEM_OPTO_IT_RISING_ADD);
+	uint16_t falling = simGet16(b, I2C_MEM_OPTO_IT_FALLING_ADD);
+	uint8_t encEn = b->mem[I2C_MEM_OPTO_ENC_ENABLE_ADD];
+	uint16_t in = 0;
+	uint16_t port = 0xffff;
+	int ch;
+	const SimGenType* g;
+	double ph;
+
+	for (ch = 0; ch < OPTO_CH_NO; ch++)
+	{
+		g = &b->gen[ch];
+		ph = simPhase(b, ch);
+		if (simLevel(g, t1, ph))
+		{
+			in |= 1 << ch;
+			// legacy port: active low, channel 1 on bit 15
+			port &= ~(0x8000 >> ch);
+		}
+		if (rising & (1 << ch))
+		{
+			b->count[ch] += simEdges(g, t1, 0, ph) - simEdges(g, t0, 0, ph);
+		}
+		if (falling & (1 << ch))
+		{
+			b->count[ch] += simEdges(g, t1, 1, ph) - simEdges(g, t0, 1, ph);
+		}
+		simPut32(b, I2C_MEM_OPTO_EDGE_COUNT_ADD + COUNTER_SIZE * ch,
+			b->count[ch]);
+		simPut16(b, I2C_MEM_IN_FREQENCY + IN_FREQENCY_SIZE * ch,
+			g->kind >= SIM_GEN_SQUARE ? (uint16_t)g->freq : 0);
+		simPut16(b, I2C_MEM_PWM_IN_FILL + PWM_IN_FILL_SIZE * ch,
+			g->kind >= SIM_GEN_SQUARE ?
+				(uint16_t)(g->duty * OPTO_FILL_FACTOR_SCALE) : 0);
+	}
+	for (ch = 0; ch < OPTO_ENC_CH_NO; ch++)
+	{
+		g = &b->gen[2 * ch];
+		if ( (encEn & (1 << ch)) && (g->kind == SIM_GEN_QUAD))
+		{
+			b->enc[ch] += (g->dir >= 0 ? 1 : -1)
+				* (int32_t)(simEdges(g, t1, 0, 0) - simEdges(g, t0, 0, 0));
+		}
+		simPut32(b, I2C_MEM_OPTO_ENC_COUNT_ADD + COUNTER_SIZE * ch,
+			(uint32_t)b->enc[ch]);
+	}
+	simPut16(b, I2C_MEM_OPTO, in);
+	simPut16(b, INPUTS16_INPORT_REG_ADD, port);
+	b->last = now;
+}
+
+static int simRead(void* ctx, int add, uint8_t* buff, int size)
+{
+	SimBoardType* b = (SimBoardType*)ctx;
+
+	simUpdate(b);
+	memcpy(buff, &b->mem[add], size);
+	return 0;
+}
+
+// Registers with an action on write, the rest is plain memory
+static void simWriteByte(SimBoardType* b, int add, uint8_t val)
+{
+	uint16_t led = simGet16(b, I2C_MEM_LEDS);
+
+	switch (add)
+	{
+	case I2C_MEM_LED_SET:
+		if ( (val >= 1) && (val <= LED_CH_NO))
+		{
+			simPut16(b, I2C_MEM_LEDS, led | (1 << (val - 1)));
+		}
+		return;
+	case I2C_MEM_LED_CLR:
+		if ( (val >= 1) && (val <= LED_CH_NO))
+		{
+			simPut16(b, I2C_MEM_LEDS, led & ~(1 << (val - 1)));
+		}
+		return;
+	case I2C_MEM_OPTO_CNT_RST_ADD:
+		if ( (val >= 1) && (val <= OPTO_CH_NO))
+		{
+			b->count[val - 1] = 0;
+		}
+		return;
+	case I2C_MEM_OPTO_ENC_CNT_RST_ADD:
+		if ( (val >= 1) && (val <= OPTO_ENC_CH_NO))
+		{
+			b->enc[val - 1] = 0;
+		}
+		return;
+	case I2C_MEM_WDT_RESET_ADD:
+		return; // reload key, nothing to keep
+	case I2C_MEM_WDT_CLEAR_RESET_COUNT_ADD:
+		if (val == WDT_RESET_COUNT_SIGNATURE)
+		{
+			simPut16(b, I2C_MEM_WDT_RESET_COUNT_ADD, 0);
+		}
+		return;
+	default:
+		break;
+	}
+	if ( (add >= INPUTS16_INPORT_REG_ADD) && (add < I2C_MEM_LED_VAL))
+	{
+		return; // inputs are read only
+	}
+	if ( (add >= I2C_MEM_OPTO_EDGE_COUNT_ADD) && (add < I2C_MEM_PWM_IN_FILL))
+	{
+		return;
+	}
+	if ( (add >= I2C_MEM_IN_FREQENCY) && (add < I2C_MEM_IN_FREQENCY_END))
+	{
+		return;
+	}
+	b->mem[add] = val;
+	// set registers are read back through the get ones
+	if ( (add >= I2C_MEM_WDT_INTERVAL_SET_ADD)
+		&& (add < I2C_MEM_WDT_INTERVAL_GET_ADD))
+	{
+		b->mem[add + I2C_MEM_WDT_INTERVAL_GET_ADD - I2C_MEM_WDT_INTERVAL_SET_ADD] =
+			val;
+	}
+	else if ( (add >= I2C_MEM_WDT_INIT_INTERVAL_SET_ADD)
+		&& (add < I2C_MEM_WDT_INIT_INTERVAL_GET_ADD))
+	{
+		b->mem[add + I2C_MEM_WDT_INIT_INTERVAL_GET_ADD
+			- I2C_MEM_WDT_INIT_INTERVAL_SET_ADD] = val;
+	}
+	else if ( (add >= I2C_MEM_WDT_POWER_OFF_INTERVAL_SET_ADD)
+		&& (add < I2C_MEM_WDT_POWER_OFF_INTERVAL_GET_ADD))
+	{
+		b->mem[add + I2C_MEM_WDT_POWER_OFF_INTERVAL_GET_ADD
+			- I2C_MEM_WDT_POWER_OFF_INTERVAL_SET_ADD] = val;
+	}
+}
+
+static int simWrite(void* ctx, int add, const uint8_t* buff, int size)
+{
+	SimBoardType* b = (SimBoardType*)ctx;
+	int i;
+
+	simUpdate(b); // edges before the write are counted with old settings
+	for (i = 0; i < size; i++)
+	{
+		simWriteByte(b, add + i, buff[i]);
+	}
+	return 0;
+}
+
+static SimBoardType* simBoard(int bus, int stack)
+{
+	SimBoardType* b;
+
+	if ( (bus < 0) || (bus >= I2C_BUS_MAX) || (stack < 0)
+		|| (stack >= SIM_STACK_MAX))
+	{
+		return NULL;
+	}
+	b = gSimBoard[bus][stack];
+	if (NULL != b)
+	{
+		return b;
+	}
+	b = calloc(1, sizeof(SimBoardType));
+	if (NULL == b)
+	{
+		return NULL;
+	}
+	b->start = b->last = simNow();
+	simPut16(b, I2C_MEM_WDT_INTERVAL_GET_ADD, 120);
+	simPut16(b, I2C_MEM_WDT_INIT_INTERVAL_GET_ADD, 120);
+	simPut32(b, I2C_MEM_WDT_POWER_OFF_INTERVAL_GET_ADD, 10);
+	simPut16(b, I2C_MEM_DIAG_3V3_MV_ADD, 3300);
+	b->mem[I2C_MEM_DIAG_TEMPERATURE_ADD] = 30;
+	simPut16(b, I2C_MEM_DIAG_5V_ADD, 5000);
+	b->mem[I2C_MEM_REVISION_HW_MAJOR_ADD] = HW_MAJOR;
+	b->mem[I2C_MEM_REVISION_HW_MINOR_ADD] = HW_MINOR;
+	b->mem[I2C_MEM_REVISION_MAJOR_ADD] = FW_MAJOR;
+	b->mem[I2C_MEM_REVISION_MINOR_ADD] = FW_MINOR;
+	simUpdate(b);
+	gSimBoard[bus][stack] = b;
+	return b;
+}
+
+int simGenSet(int bus, int stack, int ch, const SimGenType* gen)
+{
+	SimBoardType* b = simBoard(bus, stack);
+
+	if ( (NULL == b) || (NULL == gen) || (ch < MIN_CH_NO) || (ch > OPTO_CH_NO))
+	{
+		return ERROR;
+	}
+	if ( (gen->kind == SIM_GEN_QUAD) && (ch % 2 == 0))
+	{
+		return ERROR; // encoders are on channels 1/2, 3/4 ...
+	}
+	simUpdate(b);
+	b->gen[ch - 1] = *gen;
+	if ( (gen->kind == SIM_GEN_QUAD) && (ch < OPTO_CH_NO))
+	{
+		b->gen[ch] = *gen;
+	}
+	return OK;
+}
+
+static int simGenParseOne(const char* spec, int* stack, int* ch, SimGenType* g)
+{
+	char kind[16];
+	const char* p = spec;
+	const char* slash = strchr(spec, '/');
+	int n;
+
+	*stack = -1;
+	if (slash != NULL)
+	{
+		*stack = atoi(spec);
+		p = slash + 1;
+	}
+	memset(g, 0, sizeof(SimGenType));
+	g->duty = 50;
+	g->dir = 1;
+	n = sscanf(p, "%d:%15[a-z]:%lf:%lf:%d:%lf", ch, kind, &g->freq, &g->duty,
+		&g->pulses, &g->burstFreq);
+	if (n < 2)
+	{
+		return ERROR;
+	}
+	if (strcmp(kind, "low") == 0)
+	{
+		g->kind = SIM_GEN_LOW;
+	}
+	else if (strcmp(kind, "high") == 0)
+	{
+		g->kind = SIM_GEN_HIGH;
+	}
+	else if ( (strcmp(kind, "square") == 0) && (n >= 3))
+	{
+		g->kind = SIM_GEN_SQUARE;
+	}
+	else if ( (strcmp(kind, "quad") == 0) && (n >= 3))
+	{
+		g->kind = SIM_GEN_QUAD;
+		g->dir = (n >= 4) && (g->duty < 0) ? -1 : 1;
+		g->duty = 50;
+	}
+	else if ( (strcmp(kind, "burst") == 0) && (n == 6) && (g->pulses > 0)
+		&& (g->burstFreq > 0))
+	{
+		g->kind = SIM_GEN_BURST;
+	}
+	else
+	{
+		return ERROR;
+	}
+	if ( (g->duty < 0) || (g->duty > 100) || (g->freq < 0))
+	{
+		return ERROR;
+	}
+	return OK;
+}
+
+// Apply a generator list to every simulated board of every bus
+int simGenParse(const char* spec)
+{
+	char buf[128];
+	SimGenType g;
+	int stack;
+	int ch;
+	int bus;
+	int s;
+	size_t len;
+
+	while ( (NULL != spec) && (*spec != 0))
+	{
+		len = strcspn(spec, ";");
+		if (len >= sizeof(buf))
+		{
+			return ERROR;
+		}
+		memcpy(buf, spec, len);
+		buf[len] = 0;
+		spec += len;
+		if (*spec == ';')
+		{
+			spec++;
+		}
+		if (len == 0)
+		{
+			continue;
+		}
+		if (OK != simGenParseOne(buf, &stack, &ch, &g))
+		{
+			printf("Invalid simulator generator \"%s\"\n", buf);
+			return ERROR;
+		}
+		for (bus = 0; bus < I2C_BUS_MAX; bus++)
+		{
+			for (s = 0; s < SIM_STACK_MAX; s++)
+			{
+				if ( ( (stack < 0) || (stack == s))
+					&& (OK != simGenSet(bus, s, ch, &g)))
+				{
+					return ERROR;
+				}
+			}
+		}
+	}
+	return OK;
+}
+
+static int simOpen(int bus)
+{
+	static int parsed = 0;
+	LoopDevType model;
+	int stack;
+
+	if ( (bus < 0) || (bus >= I2C_BUS_MAX))
+	{
+		return -1;
+	}
+	if (!parsed)
+	{
+		parsed = 1;
+		simGenParse(getenv(SIM_ENV));
+	}
+	for (stack = 0; stack < SIM_STACK_MAX; stack++)
+	{
+		model.read = simRead;
+		model.write = simWrite;
+		model.ctx = simBoard(bus, stack);
+		if ( (NULL == model.ctx)
+			|| (loopAttach(bus, (stack + INPUT16_HW_I2C_BASE_ADD) ^ 0x07,
+				&model) != 0))
+		{
+			return -1;
+		}
+	}
+	return bus;
+}
+
+static int simTransfer(int fd, struct i2c_msg* msgs, int count)
+{
+	return I2C_TRANSPORT_LOOP.transfer(fd, msgs, count);
+}
+
+static void simClose(int fd)
+{
+	(void)fd;
+}
+
+const I2cTransportType I2C_TRANSPORT_SIM =
+{
+	"sim",
+	&simOpen,
+	&simTransfer,
+	NULL,
+	&simClose,
+	0,
+};
@@ -0,0 +1,32 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#define SIM_ENV	"SM16INPIND_SIM"
+
+typedef enum
+{
+	SIM_GEN_LOW = 0,
+	SIM_GEN_HIGH,
+	SIM_GEN_SQUARE,
+	SIM_GEN_QUAD, // channel pair: this one is A, the next one is B
+	SIM_GEN_BURST,
+	SIM_GEN_COUNT
+} SimGenKindType;
+
+// Signal applied to one simulated input
+typedef struct
+{
+	SimGenKindType kind;
+	double freq; // Hz
+	double duty; // %
+	int dir; // quadrature direction, 1 or -1
+	int pulses; // pulses per burst
+	double burstFreq; // bursts per second
+} SimGenType;
+
+int simGenSet(int bus, int stack, int ch, const SimGenType* gen);
+int simGenParse(const char* spec);
+
+#endif /* SIM_H */
@@ -0,0 +1,503 @@
+/*
+ * snapshot.c:
+ *	Poller publishing the state of every board in a shared memory
+ *	snapshot and the reader side of it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "comm.h"
+#include "data.h"
+#include "poll.h"
+#include "rt.h"
+#include "sched.h"
+#include "snapshot.h"
+
+#define SNAP_PERIOD_MAX_MS	60000
+#define SNAP_TUNE_FACTOR	4
+
+/*
+ * Register groups of the snapshot and their default periods. Counters
+ * and encoder counters are read with the PWM fill when both are due,
+ * they are contiguous in the map.
+ */
+enum
+{
+	SNAP_GRP_INPUTS,
+	SNAP_GRP_COUNTERS,
+	SNAP_GRP_PWM,
+	SNAP_GRP_FREQ,
+	SNAP_GRP_COUNT,
+};
+
+static const struct
+{
+	const char* name;
+	int add;
+	int size;
+	int periodMs;
+} gSnapGroup[SNAP_GRP_COUNT] =
+{
+	{ "inputs", I2C_MEM_OPTO, 2, 10 },
+	{ "counters", I2C_MEM_OPTO_EDGE_COUNT_ADD,
+		I2C_MEM_PWM_IN_FILL - I2C_MEM_OPTO_EDGE_COUNT_ADD, 100 },
+	{ "pwm", I2C_MEM_PWM_IN_FILL, SNAP_CH_NO * PWM_IN_FILL_SIZE, 250 },
+	{ "freq", I2C_MEM_IN_FREQENCY, SNAP_CH_NO * IN_FREQENCY_SIZE, 250 },
+};
+
+static volatile sig_atomic_t gSnapStop = 0;
+
+static void snapSignal(int sig)
+{
+	(void)sig;
+	gSnapStop = 1;
+}
+
+static uint64_t snapNowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Copy the groups refreshed by the scheduler in the board record
+static void snapUpdate(const SchedType* sc, uint32_t done, SnapBoardType* b)
+{
+	const uint8_t* mem = sc->mem;
+
+	const SchedGroupType* in = &sc->group[SNAP_GRP_INPUTS];
+
+	if (done & (1 << SNAP_GRP_INPUTS))
+	{
+		b->reqNs = in->reqNs;
+		b->doneNs = in->doneNs;
+		b->periodNs = in->stat.mean;
+		b->jitterNs = schedStatJitter(&in->stat);
+		b->jitterMaxNs = in->stat.jitterMaxNs;
+		b->lateMaxNs = in->stat.lateMaxNs;
+		b->misses = in->stat.misses;
+		memcpy(&b->inputs, &mem[I2C_MEM_OPTO], sizeof(b->inputs));
+	}
+	if (done & (1 << SNAP_GRP_COUNTERS))
+	{
+		memcpy(b->counter, &mem[I2C_MEM_OPTO_EDGE_COUNT_ADD], sizeof(b->counter));
+		memcpy(b->encoder, &mem[I2C_MEM_OPTO_ENC_COUNT_ADD], sizeof(b->encoder));
+	}
+	if (done & (1 << SNAP_GRP_PWM))
+	{
+		memcpy(b->pwm, &mem[I2C_MEM_PWM_IN_FILL], sizeof(b->pwm));
+	}
+	if (done & (1 << SNAP_GRP_FREQ))
+	{
+		memcpy(b->freq, &mem[I2C_MEM_IN_FREQENCY], sizeof(b->freq));
+	}
+}
+
+static void snapPublish(SnapType* shm, const SnapType* snap)
+{
+	uint32_t seq = shm->seq;
+
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy( ((uint8_t*)shm) + offsetof(SnapType, periodUs),
+		((const uint8_t*)snap) + offsetof(SnapType, periodUs),
+		sizeof(SnapType) - offsetof(SnapType, periodUs));
+	__atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Segment of a bus: /16inpind for the default bus, /16inpind.<bus> else
+static void snapName(int bus, char* name, int size)
+{
+	if (bus == SNAP_BUS_DEFAULT)
+	{
+		snprintf(name, size, "%s", SNAP_SHM_NAME);
+	}
+	else
+	{
+		snprintf(name, size, "%s.%d", SNAP_SHM_NAME, bus);
+	}
+}
+
+// *lock keeps the segment locked for this poller until snapDestroy()
+static SnapType* snapCreate(int bus, int* lock)
+{
+	SnapType* shm;
+	char name[32];
+	int fd;
+
+	snapName(bus, name, sizeof(name));
+	fd = shm_open(name, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		printf("Fail to create the %s shared memory\n", name);
+		return NULL;
+	}
+	// the seqlock has a single writer: a second poller of the bus is refused
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+	{
+		printf("Another poller publishes the %s shared memory\n", name);
+		close(fd);
+		return NULL;
+	}
+	fchmod(fd, 0644);
+	if (ftruncate(fd, sizeof(SnapType)) < 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	shm = mmap(NULL, sizeof(SnapType), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		0);
+	if (shm == MAP_FAILED)
+	{
+		close(fd);
+		return NULL;
+	}
+	*lock = fd;
+	// a poller that died in an update left seq odd, the readers wait for even
+	if (shm->seq & 1)
+	{
+		__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+	}
+	shm->bus = bus;
+	shm->version = SNAP_VERSION;
+	__atomic_store_n(&shm->magic, SNAP_MAGIC, __ATOMIC_RELEASE);
+	return shm;
+}
+
+static void snapDestroy(SnapType* shm, int bus, int lock)
+{
+	char name[32];
+
+	if (NULL == shm)
+	{
+		return;
+	}
+	// readers see a stale segment: the magic is cleared
+	__atomic_store_n(&shm->magic, 0, __ATOMIC_RELEASE);
+	munmap(shm, sizeof(SnapType));
+	snapName(bus, name, sizeof(name));
+	shm_unlink(name);
+	close(lock);
+}
+
+typedef struct
+{
+	const int* periodMs;
+	int tune;
+} SnapSetupType;
+
+static void snapSetup(SchedType* s, int bus, int stack, void* arg)
+{
+	const SnapSetupType* setup = arg;
+	int i;
+
+	(void)bus;
+	(void)stack;
+	for (i = 0; i < SNAP_GRP_COUNT; i++)
+	{
+		schedGroupAdd(s, gSnapGroup[i].name, gSnapGroup[i].add,
+			gSnapGroup[i].size, setup->periodMs[i] * 1000);
+		// the inputs keep their period, the reaction time depends on it
+		if (setup->tune && (i != SNAP_GRP_INPUTS))
+		{
+			schedAutoTune(&s->group[i], SNAP_TUNE_FACTOR);
+		}
+	}
+}
+
+// Frame of one bus in its snapshot, returns true if anything changed
+static int snapFrame(const PollBusType* b, uint64_t cycle, SnapType* snap)
+{
+	SnapBoardType* board;
+	int any = 0;
+	int stack;
+
+	for (stack = 0; stack < SNAP_BOARD_MAX; stack++)
+	{
+		if (b->dev[stack] <= 0)
+		{
+			continue;
+		}
+		board = &snap->board[stack];
+		if (b->failed & (1 << stack))
+		{
+			board->errors++;
+			board->present = (b->done[stack] & (1 << SNAP_GRP_INPUTS)) != 0;
+			any = 1;
+		}
+		else if (b->done[stack] & (1 << SNAP_GRP_INPUTS))
+		{
+			board->present = 1;
+		}
+		snapUpdate(&b->sched[stack], b->done[stack], board);
+		any |= b->done[stack] != 0;
+	}
+	snap->timeNs = b->startNs;
+	snap->cycles = cycle;
+	return any;
+}
+
+// Sampling statistics of every poll stream
+static void snapStatPrint(const PollType* poll)
+{
+	char prefix[32];
+	int i;
+	int stack;
+	int g;
+
+	for (i = 0; i < poll->count; i++)
+	{
+		for (stack = 0; stack < SNAP_BOARD_MAX; stack++)
+		{
+			if (poll->bus[i].dev[stack] <= 0)
+			{
+				continue;
+			}
+			snprintf(prefix, sizeof(prefix), "Bus %d stack %d ", poll->bus[i].bus,
+				stack);
+			for (g = 0; g < poll->bus[i].sched[stack].count; g++)
+			{
+				schedStatPrint(stdout, prefix, &poll->bus[i].sched[stack].group[g]);
+			}
+		}
+	}
+}
+
+static int snapPoll(const int* bus, int count, const int* periodMs, int tune,
+	const RtType* rt)
+{
+	static PollType poll;
+	static SnapType snap[I2C_BUS_MAX];
+	SnapType* shm[I2C_BUS_MAX];
+	int lock[I2C_BUS_MAX];
+	SnapSetupType setup = { periodMs, tune };
+	struct timespec next;
+	uint64_t wake;
+	int ret = OK;
+	int i;
+
+	if (pollOpen(&poll, bus, count, snapSetup, &setup) <= 0)
+	{
+		printf("No board detected\n");
+		return ERROR;
+	}
+	for (i = 0; i < count; i++)
+	{
+		memset(&snap[i], 0, sizeof(SnapType));
+		snap[i].bus = bus[i];
+		snap[i].periodUs = periodMs[SNAP_GRP_INPUTS] * 1000;
+		shm[i] = snapCreate(bus[i], &lock[i]);
+		if (NULL == shm[i])
+		{
+			ret = ERROR;
+			continue;
+		}
+		rtPrefault(shm[i], sizeof(SnapType));
+	}
+	rtPrefault(&poll, sizeof(poll));
+	rtPrefault(snap, sizeof(snap));
+	if ( (ret == OK) && ( (rtSetup(rt) != OK) || (pollStart(&poll) != OK)))
+	{
+		ret = ERROR;
+	}
+	signal(SIGINT, snapSignal);
+	signal(SIGTERM, snapSignal);
+	while ( (ret == OK) && !gSnapStop)
+	{
+		pollCycle(&poll, snapNowNs());
+		for (i = 0; i < count; i++)
+		{
+			if (snapFrame(&poll.bus[i], poll.cycle, &snap[i]))
+			{
+				snapPublish(shm[i], &snap[i]);
+			}
+		}
+		wake = pollNext(&poll);
+		next.tv_sec = wake / 1000000000ULL;
+		next.tv_nsec = wake % 1000000000ULL;
+		while ( (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+			&& !gSnapStop)
+			;
+	}
+	for (i = 0; i < count; i++)
+	{
+		snapDestroy(shm[i], bus[i], lock[i]);
+	}
+	pollClose(&poll);
+	if (ret == OK)
+	{
+		snapStatPrint(&poll);
+	}
+	i2cClose();
+	return ret;
+}
+
+const SnapType* snapOpenBus(int bus)
+{
+	const SnapType* shm;
+	char name[32];
+	int fd;
+
+	snapName(bus, name, sizeof(name));
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	shm = mmap(NULL, sizeof(SnapType), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	return shm == MAP_FAILED ? NULL : shm;
+}
+
+const SnapType* snapOpen(void)
+{
+	return snapOpenBus(SNAP_BUS_DEFAULT);
+}
+
+/*
+ * Consistent copy of the segment: OK, ERROR without a poller, SNAP_STALE
+ * if no consistent copy could be made in SNAP_READ_TIMEOUT_MS (the poller
+ * died in an update).
+ */
+int snapRead(const SnapType* shm, SnapType* snap)
+{
+	uint64_t start = 0;
+	uint32_t seq;
+
+	if ( (NULL == shm) || (NULL == snap))
+	{
+		return ERROR;
+	}
+	while (1)
+	{
+		if ( (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != SNAP_MAGIC)
+			|| (shm->version != SNAP_VERSION))
+		{
+			return ERROR;
+		}
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if ( (seq & 1) == 0)
+		{
+			memcpy(snap, (const void*)shm, sizeof(SnapType));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+			{
+				return OK;
+			}
+		}
+		// the clock is read on the retry path only
+		if (start == 0)
+		{
+			start = snapNowNs();
+		}
+		else if (snapNowNs() - start > SNAP_READ_TIMEOUT_MS * 1000000ULL)
+		{
+			return SNAP_STALE;
+		}
+		sched_yield();
+	}
+}
+
+void snapClose(const SnapType* shm)
+{
+	if (NULL != shm)
+	{
+		munmap((void*)shm, sizeof(SnapType));
+	}
+}
+
+const CliCmdType CMD_POLLER =
+{
+	"-poller",
+	1,
+	&doPoller,
+	"  -poller          Sample all boards and publish the state in /dev/shm"SNAP_SHM_NAME"[.<bus>]\n",
+	"  Usage:           "PROGRAM_NAME" -poller [<inputs period ms>] [counters|pwm|freq=<period ms>]... [auto] [rt[=<prio>]] [cpu=<n>[,<n>]...]\n",
+	"  Example:         "PROGRAM_NAME" -poller 1 counters=50 auto rt cpu=3; Inputs every 1ms, counters every 50ms, other periods adapted to the data, SCHED_FIFO on CPU 3\n"
+};
+
+int doPoller(int argc, char *argv[])
+{
+	int period[SNAP_GRP_COUNT];
+	int bus[I2C_BUS_MAX];
+	int count = 0;
+	int tune = 0;
+	RtType rt = { 0, 0 };
+	char* sep;
+	int i;
+	int j;
+
+	for (i = 0; i < SNAP_GRP_COUNT; i++)
+	{
+		period[i] = gSnapGroup[i].periodMs;
+	}
+	for (i = 2; i < argc; i++)
+	{
+		sep = strchr(argv[i], '=');
+		j = SNAP_GRP_INPUTS;
+		if (strcasecmp(argv[i], "auto") == 0)
+		{
+			tune = 1;
+			continue;
+		}
+		if ( (strcasecmp(argv[i], "rt") == 0) || (strncasecmp(argv[i], "rt=", 3) == 0))
+		{
+			rt.prio = argv[i][2] ? atoi(argv[i] + 3) : RT_PRIO_DEFAULT;
+			if ( (rt.prio < sched_get_priority_min(SCHED_FIFO))
+				|| (rt.prio > sched_get_priority_max(SCHED_FIFO)))
+			{
+				printf("Invalid real-time priority [%d..%d]!\n",
+					sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+				return ARG_RANGE_ERROR;
+			}
+			continue;
+		}
+		if (strncasecmp(argv[i], "cpu=", 4) == 0)
+		{
+			if (rtCpusParse(argv[i] + 4, &rt.cpus) != OK)
+			{
+				printf("Invalid CPU list %s\n", argv[i] + 4);
+				return ARG_RANGE_ERROR;
+			}
+			continue;
+		}
+		if (sep != NULL)
+		{
+			for (j = 0; j < SNAP_GRP_COUNT; j++)
+			{
+				if ( (strncasecmp(argv[i], gSnapGroup[j].name, sep - argv[i]) == 0)
+					&& (gSnapGroup[j].name[sep - argv[i]] == 0))
+				{
+					break;
+				}
+			}
+			if (j == SNAP_GRP_COUNT)
+			{
+				printf("Invalid register group %s\n", argv[i]);
+				return ARG_RANGE_ERROR;
+			}
+		}
+		period[j] = atoi(sep != NULL ? sep + 1 : argv[i]);
+		if ( (period[j] < 1) || (period[j] > SNAP_PERIOD_MAX_MS))
+		{
+			printf("Invalid period [1..%d]ms!\n", SNAP_PERIOD_MAX_MS);
+			return ARG_RANGE_ERROR;
+		}
+	}
+	count = i2cBusGet(bus, I2C_BUS_MAX);
+	return snapPoll(bus, count, period, tune, &rt);
+}
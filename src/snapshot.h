@@ -0,0 +1,66 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "cli.h"
+
+#define SNAP_SHM_NAME	"/16inpind"
+#define SNAP_BUS_DEFAULT	1 // published without the bus suffix
+#define SNAP_MAGIC	0x31364950 // "PI61"
+#define SNAP_VERSION	3
+#define SNAP_BOARD_MAX	8
+#define SNAP_CH_NO	16
+#define SNAP_ENC_CH_NO	8
+#define SNAP_READ_TIMEOUT_MS	100 // longest update a reader waits for
+#define SNAP_STALE	-5 // snapRead(): the writer stopped in the middle of an update
+
+/*
+ * Latest state of the boards of one bus, published by the poller in shared
+ * memory (/dev/shm/16inpind, /dev/shm/16inpind.<bus> for the other buses).
+ * The writer makes seq odd while it updates the segment, readers copy it
+ * and retry until they see the same even seq before and after the copy:
+ * no lock and no bus access on read. A reader gives up with SNAP_STALE
+ * after SNAP_READ_TIMEOUT_MS, when the poller died in an update.
+ */
+typedef struct
+{
+	uint32_t present; // board answered the last sample
+	uint32_t errors; // failed samples since the poller start
+	uint64_t reqNs; // CLOCK_MONOTONIC_RAW request of the inputs read
+	uint64_t doneNs; // and its completion
+	uint16_t inputs; // bit 0 = channel 1
+	uint16_t reserved;
+	uint32_t periodNs; // mean interval between the inputs samples
+	uint32_t jitterNs; // its standard deviation
+	uint32_t jitterMaxNs; // largest distance from the set period
+	uint32_t lateMaxNs; // largest delay of an inputs read after its due time
+	uint32_t misses; // inputs samples lost to late reads
+	uint32_t counter[SNAP_CH_NO];
+	int32_t encoder[SNAP_ENC_CH_NO];
+	uint16_t pwm[SNAP_CH_NO]; // fill factor in 0.01%
+	uint16_t freq[SNAP_CH_NO]; // Hz
+} SnapBoardType;
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t bus;
+	uint32_t seq;
+	uint32_t periodUs;
+	uint64_t timeNs; // CLOCK_MONOTONIC of the last cycle
+	uint64_t cycles;
+	SnapBoardType board[SNAP_BOARD_MAX]; // by stack level
+} SnapType;
+
+extern const CliCmdType CMD_POLLER;
+
+// reader API
+const SnapType* snapOpen(void);
+const SnapType* snapOpenBus(int bus);
+int snapRead(const SnapType* shm, SnapType* snap);
+void snapClose(const SnapType* shm);
+
+int doPoller(int argc, char *argv[]);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,45 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+#include <linux/i2c.h>
+
+/*
+ * Bus backend used by comm.c. Every access (single read, write or a
+ * batch of register windows) reaches the backend as one combined
+ * transfer: a list of i2c messages executed with repeated starts.
+ */
+typedef struct
+{
+	const char* name;
+	// returns a descriptor >= 0 for the bus or -1
+	int (*open)(int bus);
+	// same contract as ioctl(I2C_RDWR): messages done or -1 with errno set
+	int (*transfer)(int fd, struct i2c_msg* msgs, int count);
+	// optional, adapter timeout and retries
+	void (*adapter)(int fd, int timeoutMs, int retries);
+	void (*close)(int fd);
+	// the bus is shared with other processes: transfers run under the bus lock
+	int shared;
+} I2cTransportType;
+
+extern const I2cTransportType I2C_TRANSPORT_DEV;
+extern const I2cTransportType I2C_TRANSPORT_LOOP;
+extern const I2cTransportType I2C_TRANSPORT_SIM;
+extern const I2cTransportType I2C_TRANSPORT_DAEMON;
+
+/*
+ * Loopback devices: a board model answering the messages sent to one
+ * slave address, register pointer handling is done by the backend.
+ */
+typedef struct
+{
+	int (*read)(void* ctx, int add, uint8_t* buff, int size);
+	int (*write)(void* ctx, int add, const uint8_t* buff, int size);
+	void* ctx;
+} LoopDevType;
+
+int loopAttach(int bus, int slave, const LoopDevType* model);
+void loopDetach(int bus, int slave);
+
+#endif /* TRANSPORT_H */
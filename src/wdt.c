@@ -7,6 +7,7 @@
 #include "comm.h"
 #include "data.h"
 #include "board.h"
+#include "out.h"
 #include "wdt.h"
 
 const CliCmdType CMD_WDT_RELOAD = {
@@ -57,7 +58,8 @@ int doWdtGetPeriod(int argc, char *argv[]) {
 	}
 	uint16_t period;
 	memcpy(&period, buf, 2);
-	printf("%d\n", (int)period);
+	outText("%d\n", (int)period);
+	outInt("period", period);
 	return OK;
 }
 
@@ -148,7 +150,8 @@ int doWdtGetInitPeriod(int argc, char *argv[]) {
 	}
 	uint16_t period;
 	memcpy(&period, buf, 2);
-	printf("%d\n", (int)period);
+	outText("%d\n", (int)period);
+	outInt("period", period);
 	return OK;
 }
 
@@ -177,7 +180,8 @@ int doWdtGetOffPeriod(int argc, char *argv[])
 	}
 	uint32_t period;
 	memcpy(&period, buf, 4);
-	printf("%d\n", (int)period);
+	outText("%d\n", (int)period);
+	outInt("period", period);
 
 	return OK;
 }
@@ -237,7 +241,8 @@ int doWdtGetResetCount(int argc, char *argv[]) {
 	}
 	uint16_t period;
 	memcpy(&period, buf, 2);
-	printf("%d\n", (int)period);
+	outText("%d\n", (int)period);
+	outInt("count", period);
 	return OK;
 }
 